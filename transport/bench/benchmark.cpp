@@ -0,0 +1,88 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <sstream>
+
+using namespace std;
+
+namespace Bench {
+
+    Result Measure(string name, const function<void()>& body, chrono::milliseconds min_time) {
+        using Clock = chrono::steady_clock;
+        body();
+
+        Result result{.name = move(name), .min_ns = numeric_limits<double>::infinity()};
+        const auto start = Clock::now();
+        auto now = start;
+        do {
+            const auto iteration_start = now;
+            body();
+            now = Clock::now();
+            result.min_ns = min(result.min_ns, chrono::duration<double, nano>(now - iteration_start).count());
+            ++result.iterations;
+        } while (now - start < min_time);
+        result.mean_ns = chrono::duration<double, nano>(now - start).count() / result.iterations;
+        return result;
+    }
+
+    // Json::Load reads neither exponents nor integers beyond int, so times
+    // are written as fixed-point microseconds
+    Json::Node ToMicrosecondsJson(double nanoseconds) {
+        ostringstream text;
+        text << fixed << setprecision(3) << nanoseconds / 1000;
+        return Json::Raw{{make_shared<const string>(text.str())}};
+    }
+
+    Json::Dict ToJson(const Json::Dict& params, const vector<Result>& results) {
+        vector<Json::Node> results_json;
+        results_json.reserve(results.size());
+        for (const Result& result : results) {
+            results_json.emplace_back(Json::Dict{
+                {"name", Json::Node(result.name)},
+                {"iterations", Json::Node(static_cast<int>(result.iterations))},
+                {"mean_us", ToMicrosecondsJson(result.mean_ns)},
+                {"min_us", ToMicrosecondsJson(result.min_ns)},
+            });
+        }
+        return {
+            {"params", Json::Node(params)},
+            {"results", Json::Node(move(results_json))},
+        };
+    }
+
+    vector<Result> ReadResults(const Json::Dict& json) {
+        vector<Result> results;
+        for (const Json::Node& node : json.at("results").AsArray()) {
+            const auto& result = node.AsMap();
+            results.push_back({
+                .name = result.at("name").AsString(),
+                .iterations = static_cast<size_t>(result.at("iterations").AsInt()),
+                .mean_ns = result.at("mean_us").AsDouble() * 1000,
+                .min_ns = result.at("min_us").AsDouble() * 1000,
+            });
+        }
+        return results;
+    }
+
+    bool CompareWithBaseline(const vector<Result>& results, const vector<Result>& baseline,
+                             double tolerance, ostream& report) {
+        bool passed = true;
+        for (const Result& result : results) {
+            const auto it = find_if(begin(baseline), end(baseline), [&result](const Result& item) {
+                return item.name == result.name;
+            });
+            if (it == end(baseline)) {
+                continue;
+            }
+            const double ratio = result.min_ns / it->min_ns;
+            const bool regressed = ratio > 1 + tolerance;
+            passed = passed && !regressed;
+            report << left << setw(24) << result.name << right << fixed << setprecision(3)
+                   << setw(10) << ratio << 'x' << (regressed ? "  REGRESSION" : "") << '\n';
+        }
+        return passed;
+    }
+}
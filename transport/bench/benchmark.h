@@ -0,0 +1,40 @@
+#pragma once
+
+#include "json.h"
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace Bench {
+
+    struct Result {
+        std::string name;
+        size_t iterations = 0;
+        double mean_ns = 0;
+        // The fastest run, the least disturbed by the rest of the machine,
+        // is what baselines are compared by
+        double min_ns = 0;
+    };
+
+    // Runs body once to warm up, then again and again until min_time has
+    // passed, at least once
+    Result Measure(std::string name, const std::function<void()>& body, std::chrono::milliseconds min_time);
+
+    // Keeps the compiler from dropping a computation whose result is unused
+    template <typename Value>
+    void DoNotOptimize(const Value& value) {
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+
+    // {"params": params, "results": [{"name", "iterations", "mean_us", "min_us"}...]}
+    Json::Dict ToJson(const Json::Dict& params, const std::vector<Result>& results);
+    std::vector<Result> ReadResults(const Json::Dict& json);
+
+    // Writes a line per benchmark found in both and returns false if any is
+    // slower than the baseline by more than tolerance, a fraction
+    bool CompareWithBaseline(const std::vector<Result>& results, const std::vector<Result>& baseline,
+                             double tolerance, std::ostream& report);
+}
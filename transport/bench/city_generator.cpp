@@ -0,0 +1,263 @@
+#include "city_generator.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace Bench {
+
+    class Random {
+    public:
+        explicit Random(uint64_t seed) : engine_(seed) {}
+
+        // In [0, 1)
+        double NextUniform() {
+            return (engine_() >> 11) * 0x1.0p-53;
+        }
+
+        // In [0, bound); the modulo bias is negligible for small bounds
+        size_t NextIndex(size_t bound) {
+            return engine_() % bound;
+        }
+
+    private:
+        mt19937_64 engine_;
+    };
+
+    // The city covers about 30 by 25 kilometers
+    static constexpr Sphere::Point CITY_CORNER = {.latitude = 55.55, .longitude = 37.35};
+    static constexpr double CITY_LATITUDE_SPAN = 0.3;
+    static constexpr double CITY_LONGITUDE_SPAN = 0.4;
+
+    class CityBuilder {
+    public:
+        explicit CityBuilder(const CityParams& params)
+            : params_(params),
+              random_(params.seed)
+        {}
+
+        Json::Dict Build() {
+            PlaceStops();
+            const auto buses = MakeBuses();
+            AddExtraDistances();
+
+            vector<Json::Node> base_requests;
+            base_requests.reserve(params_.stop_count + buses.size());
+            for (size_t stop = 0; stop < params_.stop_count; ++stop) {
+                base_requests.push_back(MakeStopDescription(stop));
+            }
+            for (const auto& bus : buses) {
+                base_requests.push_back(bus);
+            }
+
+            return {
+                {"routing_settings", Json::Dict{
+                    {"bus_wait_time", Json::Node(6)},
+                    {"bus_velocity", Json::Node(40)},
+                }},
+                {"render_settings", MakeRenderSettings()},
+                {"base_requests", Json::Node(move(base_requests))},
+                {"stat_requests", MakeStatRequests(buses.size())},
+            };
+        }
+
+    private:
+        static string GetStopName(size_t stop) {
+            return "Stop " + to_string(stop);
+        }
+
+        static string GetBusName(size_t bus) {
+            return to_string(bus + 1);
+        }
+
+        void PlaceStops() {
+            positions_.reserve(params_.stop_count);
+            for (size_t stop = 0; stop < params_.stop_count; ++stop) {
+                positions_.push_back({
+                    .latitude = CITY_CORNER.latitude + random_.NextUniform() * CITY_LATITUDE_SPAN,
+                    .longitude = CITY_CORNER.longitude + random_.NextUniform() * CITY_LONGITUDE_SPAN,
+                });
+            }
+            distances_.resize(params_.stop_count);
+        }
+
+        // The nearest of a few random stops other than from, so routes and
+        // roads mostly join stops close to each other
+        size_t PickNearbyStop(size_t from) {
+            static constexpr size_t CANDIDATE_COUNT = 8;
+            size_t best = from;
+            double best_distance = 0;
+            for (size_t attempt = 0; attempt < CANDIDATE_COUNT; ++attempt) {
+                const size_t candidate = random_.NextIndex(params_.stop_count);
+                if (candidate == from) {
+                    continue;
+                }
+                const double distance = Sphere::Distance(positions_[from], positions_[candidate]);
+                if (best == from || distance < best_distance) {
+                    best = candidate;
+                    best_distance = distance;
+                }
+            }
+            return best == from ? (from + 1) % params_.stop_count : best;
+        }
+
+        // Roads wind, so they are up to half as long again as the straight line
+        void AddDistance(size_t from, size_t to) {
+            auto& from_distances = distances_[from];
+            auto& to_distances = distances_[to];
+            const auto has_road_to = [](const vector<pair<size_t, int>>& distances, size_t stop) {
+                return any_of(begin(distances), end(distances), [stop](const auto& item) { return item.first == stop; });
+            };
+            if (has_road_to(from_distances, to) || has_road_to(to_distances, from)) {
+                return;
+            }
+            const double straight = Sphere::Distance(positions_[from], positions_[to]);
+            const int distance = max(1, static_cast<int>(straight * (1 + random_.NextUniform() / 2)));
+            from_distances.emplace_back(to, distance);
+        }
+
+        vector<Json::Node> MakeBuses() {
+            vector<Json::Node> buses;
+            if (params_.stop_count < 2) {
+                return buses;
+            }
+            buses.reserve(params_.bus_count);
+            for (size_t bus = 0; bus < params_.bus_count; ++bus) {
+                const bool is_roundtrip = random_.NextUniform() < params_.roundtrip_ratio;
+                vector<size_t> stops = {random_.NextIndex(params_.stop_count)};
+                while (stops.size() < max<size_t>(params_.route_length, 2)) {
+                    stops.push_back(PickNearbyStop(stops.back()));
+                }
+                if (is_roundtrip && stops.back() != stops.front()) {
+                    stops.push_back(stops.front());
+                }
+
+                vector<Json::Node> stop_names;
+                stop_names.reserve(stops.size());
+                for (size_t index = 0; index < stops.size(); ++index) {
+                    if (index > 0) {
+                        AddDistance(stops[index - 1], stops[index]);
+                    }
+                    stop_names.push_back(Json::Node(GetStopName(stops[index])));
+                }
+                buses.emplace_back(Json::Dict{
+                    {"type", Json::Node("Bus"s)},
+                    {"name", Json::Node(GetBusName(bus))},
+                    {"stops", Json::Node(move(stop_names))},
+                    {"is_roundtrip", Json::Node(is_roundtrip)},
+                });
+            }
+            return buses;
+        }
+
+        void AddExtraDistances() {
+            if (params_.stop_count < 2) {
+                return;
+            }
+            const auto extra_count = static_cast<size_t>(params_.distance_density * params_.stop_count);
+            for (size_t road = 0; road < extra_count; ++road) {
+                const size_t from = random_.NextIndex(params_.stop_count);
+                AddDistance(from, PickNearbyStop(from));
+            }
+        }
+
+        Json::Node MakeStopDescription(size_t stop) const {
+            Json::Dict road_distances;
+            for (const auto& [to, distance] : distances_[stop]) {
+                road_distances.emplace(GetStopName(to), Json::Node(distance));
+            }
+            return Json::Dict{
+                {"type", Json::Node("Stop"s)},
+                {"name", Json::Node(GetStopName(stop))},
+                {"latitude", Json::Node(positions_[stop].latitude)},
+                {"longitude", Json::Node(positions_[stop].longitude)},
+                {"road_distances", Json::Node(move(road_distances))},
+            };
+        }
+
+        static Json::Node MakeRenderSettings() {
+            const auto make_point = [](double x, double y) {
+                return Json::Node(vector<Json::Node>{Json::Node(x), Json::Node(y)});
+            };
+            return Json::Dict{
+                {"width", Json::Node(1200)},
+                {"height", Json::Node(1200)},
+                {"padding", Json::Node(50)},
+                {"stop_radius", Json::Node(5)},
+                {"line_width", Json::Node(14)},
+                {"stop_label_font_size", Json::Node(20)},
+                {"stop_label_offset", make_point(7, -3)},
+                {"underlayer_color", Json::Node(vector<Json::Node>{
+                    Json::Node(255), Json::Node(255), Json::Node(255), Json::Node(0.85)
+                })},
+                {"underlayer_width", Json::Node(3)},
+                {"color_palette", Json::Node(vector<Json::Node>{
+                    Json::Node("green"s),
+                    Json::Node(vector<Json::Node>{Json::Node(255), Json::Node(160), Json::Node(0)}),
+                    Json::Node("red"s),
+                })},
+                {"bus_label_font_size", Json::Node(20)},
+                {"bus_label_offset", make_point(7, 15)},
+                {"layers", Json::Node(vector<Json::Node>{
+                    Json::Node("bus_lines"s), Json::Node("bus_labels"s),
+                    Json::Node("stop_points"s), Json::Node("stop_labels"s),
+                })},
+            };
+        }
+
+        // Mostly Route requests, as in production, then a single Map
+        Json::Node MakeStatRequests(size_t bus_count) {
+            vector<Json::Node> requests;
+            if (params_.stop_count == 0) {
+                return requests;
+            }
+            requests.reserve(params_.request_count + 1);
+            for (size_t id = 1; id <= params_.request_count; ++id) {
+                Json::Dict request = {{"id", Json::Node(static_cast<int>(id))}};
+                const double kind = random_.NextUniform();
+                if (kind < 0.2) {
+                    request.emplace("type", "Stop"s);
+                    request.emplace("name", GetStopName(random_.NextIndex(params_.stop_count)));
+                } else if (kind < 0.4 && bus_count > 0) {
+                    request.emplace("type", "Bus"s);
+                    request.emplace("name", GetBusName(random_.NextIndex(bus_count)));
+                } else {
+                    request.emplace("type", "Route"s);
+                    request.emplace("from", GetStopName(random_.NextIndex(params_.stop_count)));
+                    request.emplace("to", GetStopName(random_.NextIndex(params_.stop_count)));
+                }
+                requests.emplace_back(move(request));
+            }
+            requests.emplace_back(Json::Dict{
+                {"id", Json::Node(static_cast<int>(params_.request_count + 1))},
+                {"type", Json::Node("Map"s)},
+            });
+            return requests;
+        }
+
+        const CityParams& params_;
+        Random random_;
+        vector<Sphere::Point> positions_;
+        vector<vector<pair<size_t, int>>> distances_;  // by stop: (to, meters)
+    };
+
+    Json::Dict GenerateCity(const CityParams& params) {
+        return CityBuilder(params).Build();
+    }
+
+    Json::Dict ToJson(const CityParams& params) {
+        return {
+            {"stop_count", Json::Node(static_cast<int>(params.stop_count))},
+            {"bus_count", Json::Node(static_cast<int>(params.bus_count))},
+            {"route_length", Json::Node(static_cast<int>(params.route_length))},
+            {"roundtrip_ratio", Json::Node(params.roundtrip_ratio)},
+            {"distance_density", Json::Node(params.distance_density)},
+            {"request_count", Json::Node(static_cast<int>(params.request_count))},
+            {"seed", Json::Node(static_cast<int>(params.seed))},
+        };
+    }
+}
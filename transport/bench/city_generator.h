@@ -0,0 +1,28 @@
+#pragma once
+
+#include "json.h"
+
+#include <cstdint>
+
+// Synthetic transport networks in the input format the transport binary
+// reads. The document depends on the parameters alone: the generator draws
+// from std::mt19937_64 directly rather than through the standard
+// distributions, whose results differ between library implementations.
+namespace Bench {
+
+    struct CityParams {
+        size_t stop_count = 200;
+        size_t bus_count = 40;
+        // Stops listed per bus, a roundtrip's closing stop aside
+        size_t route_length = 12;
+        double roundtrip_ratio = 0.5;
+        // Road distances per stop on top of those the bus routes need
+        double distance_density = 1.0;
+        size_t request_count = 1000;
+        uint64_t seed = 1;
+    };
+
+    Json::Dict GenerateCity(const CityParams& params);
+
+    Json::Dict ToJson(const CityParams& params);
+}
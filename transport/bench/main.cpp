@@ -0,0 +1,206 @@
+// Microbenchmarks of the catalog's stages over a synthetic city. Built from
+// the sources in this directory and every source of the transport binary
+// but its main.cpp, with the transport directory on the include path.
+//
+//   bench [city options] [--min-time-ms N] [--only NAME]
+//         [--output FILE] [--baseline FILE] [--tolerance FRACTION]
+//   bench [city options] --generate
+//
+// City options are --stops, --buses, --route-length, --roundtrip-ratio,
+// --distance-density, --requests and --seed; see Bench::CityParams.
+// Results are printed as JSON, or written to the output file, and can be
+// stored as a baseline for later runs: with --baseline the exit code is 1
+// if any benchmark got slower than tolerance allows.
+
+#include "benchmark.h"
+#include "city_generator.h"
+
+#include "descriptions.h"
+#include "json.h"
+#include "map_renderer.h"
+#include "network.h"
+#include "requests.h"
+#include "thread_pool.h"
+#include "transport_catalog.h"
+#include "transport_router.h"
+
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+struct Options {
+    Bench::CityParams city;
+    bool generate = false;
+    chrono::milliseconds min_time{500};
+    optional<string> only;
+    optional<string> output_path;
+    optional<string> baseline_path;
+    double tolerance = 0.1;
+};
+
+Options ParseOptions(const vector<string_view>& args) {
+    Options options;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string_view arg = args[i];
+        if (arg == "--generate") {
+            options.generate = true;
+            continue;
+        }
+        if (i + 1 == args.size()) {
+            throw invalid_argument("missing value for " + string(arg));
+        }
+        const string value(args[++i]);
+        if (arg == "--stops") {
+            options.city.stop_count = stoul(value);
+        } else if (arg == "--buses") {
+            options.city.bus_count = stoul(value);
+        } else if (arg == "--route-length") {
+            options.city.route_length = stoul(value);
+        } else if (arg == "--roundtrip-ratio") {
+            options.city.roundtrip_ratio = stod(value);
+        } else if (arg == "--distance-density") {
+            options.city.distance_density = stod(value);
+        } else if (arg == "--requests") {
+            options.city.request_count = stoul(value);
+        } else if (arg == "--seed") {
+            options.city.seed = stoull(value);
+        } else if (arg == "--min-time-ms") {
+            options.min_time = chrono::milliseconds(stoul(value));
+        } else if (arg == "--only") {
+            options.only = value;
+        } else if (arg == "--output") {
+            options.output_path = value;
+        } else if (arg == "--baseline") {
+            options.baseline_path = value;
+        } else if (arg == "--tolerance") {
+            options.tolerance = stod(value);
+        } else {
+            throw invalid_argument("unknown option " + string(arg));
+        }
+    }
+    return options;
+}
+
+Json::Dict LoadJsonFile(const string& path) {
+    ifstream input(path);
+    if (!input) {
+        throw runtime_error("cannot open " + path);
+    }
+    return Json::Load(input).GetRoot().AsMap();
+}
+
+string ToString(const Json::Dict& json) {
+    ostringstream output;
+    Json::PrintValue(json, output);
+    return output.str();
+}
+
+vector<Bench::Result> RunBenchmarks(const Json::Dict& city, const Options& options) {
+    vector<Bench::Result> results;
+    const auto run = [&](string name, const function<void()>& body) {
+        if (!options.only || *options.only == name) {
+            cerr << name << "..." << endl;
+            results.push_back(Bench::Measure(move(name), body, options.min_time));
+        }
+    };
+
+    const string city_text = ToString(city);
+    const auto& base_requests = city.at("base_requests").AsArray();
+    const auto& stat_requests = city.at("stat_requests").AsArray();
+    const auto& routing_settings = city.at("routing_settings").AsMap();
+    const auto& render_settings = city.at("render_settings").AsMap();
+
+    run("json_load", [&] {
+        istringstream input(city_text);
+        Bench::DoNotOptimize(Json::Load(input));
+    });
+    run("read_descriptions", [&] {
+        Bench::DoNotOptimize(Descriptions::ReadDescriptions(base_requests));
+    });
+
+    const auto descriptions = Descriptions::ReadDescriptions(base_requests);
+    const Network::Model network(descriptions);
+    // graph filling included, as Graph::Router needs a graph that only
+    // TransportRouter builds
+    run("router_build", [&] {
+        const TransportRouter router(network, routing_settings);
+        Bench::DoNotOptimize(router);
+    });
+    ThreadPool pool(thread::hardware_concurrency());
+    run("map_render", [&] {
+        const MapRenderer renderer(network, render_settings);
+        Bench::DoNotOptimize(renderer.Render(pool));
+    });
+    // including a copy of the descriptions, which the catalog consumes
+    run("catalog_build", [&] {
+        const TransportCatalog catalog(descriptions, routing_settings, render_settings, {});
+        Bench::DoNotOptimize(catalog);
+    });
+
+    const TransportCatalog catalog(descriptions, routing_settings, render_settings, {});
+    vector<pair<string, string>> routes;
+    for (const Json::Node& request : stat_requests) {
+        const auto& attrs = request.AsMap();
+        if (attrs.at("type").AsString() == "Route") {
+            routes.emplace_back(attrs.at("from").AsString(), attrs.at("to").AsString());
+        }
+    }
+    size_t next_route = 0;
+    if (!routes.empty()) {
+        run("find_route", [&] {
+            const auto& [from, to] = routes[next_route++ % routes.size()];
+            Bench::DoNotOptimize(catalog.FindRoute(from, to));
+        });
+    }
+    run("process_requests", [&] {
+        Bench::DoNotOptimize(Requests::ProcessAll(catalog, stat_requests));
+    });
+    const auto responses = Requests::ProcessAll(catalog, stat_requests);
+    run("print_responses", [&] {
+        ostringstream output;
+        Json::PrintValue(responses, output);
+        Bench::DoNotOptimize(output.str());
+    });
+    return results;
+}
+
+int main(int argc, const char* argv[]) {
+    const Options options = ParseOptions({argv + 1, argv + argc});
+    const Json::Dict city = Bench::GenerateCity(options.city);
+    if (options.generate) {
+        Json::PrintValue(city, cout);
+        cout << endl;
+        return 0;
+    }
+
+    const Json::Dict params = Bench::ToJson(options.city);
+    const auto results = RunBenchmarks(city, options);
+    const Json::Dict results_json = Bench::ToJson(params, results);
+    if (options.output_path) {
+        ofstream output(*options.output_path);
+        Json::PrintValue(results_json, output);
+        output << endl;
+    } else {
+        Json::PrintValue(results_json, cout);
+        cout << endl;
+    }
+
+    if (!options.baseline_path) {
+        return 0;
+    }
+    const Json::Dict baseline = LoadJsonFile(*options.baseline_path);
+    // by text, as the doubles among the params may come back as ints
+    if (ToString(baseline.at("params").AsMap()) != ToString(params)) {
+        cerr << "warning: the baseline was measured on a different city" << endl;
+    }
+    return Bench::CompareWithBaseline(results, Bench::ReadResults(baseline), options.tolerance, cerr) ? 0 : 1;
+}
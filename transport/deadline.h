@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <stdexcept>
+
+// A time budget for answering one request. Long computations check the
+// deadline of the calling thread now and then, see CheckActive, and give up
+// by throwing Deadline::Exceeded; without a deadline a check only reads a
+// thread-local pointer.
+class Deadline {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Exceeded : std::runtime_error {
+        Exceeded() : std::runtime_error("timeout") {}
+    };
+
+    // Counts from now
+    explicit Deadline(Clock::duration budget) : expiry_(Clock::now() + budget) {}
+
+    bool IsExpired() const { return Clock::now() >= expiry_; }
+
+    // Budgets are given in milliseconds, fractions allowed
+    static Clock::duration FromMilliseconds(double milliseconds) {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(milliseconds));
+    }
+
+    // Throws Exceeded if the deadline of the calling thread has passed
+    static void CheckActive();
+
+private:
+    Clock::time_point expiry_;
+};
+
+// The deadline of the request the calling thread is answering, if any
+inline thread_local const Deadline* active_deadline = nullptr;
+
+inline void Deadline::CheckActive() {
+    if (active_deadline && active_deadline->IsExpired()) {
+        throw Exceeded();
+    }
+}
+
+// Makes deadline the calling thread's active one for the scope
+class ActiveDeadline {
+public:
+    explicit ActiveDeadline(const Deadline& deadline) : previous_(active_deadline) { active_deadline = &deadline; }
+    ~ActiveDeadline() { active_deadline = previous_; }
+
+    ActiveDeadline(const ActiveDeadline&) = delete;
+    ActiveDeadline& operator=(const ActiveDeadline&) = delete;
+
+private:
+    const Deadline* previous_;
+};
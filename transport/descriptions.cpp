@@ -13,21 +13,15 @@ namespace Descriptions {
             }
         };
         if (attrs.count("road_distances") > 0) {
-            for (const auto& [neighbour_stop, distance_node] : attrs.at("road_distances").AsMap()) {
-                stop.distances[neighbour_stop] = distance_node.AsInt();
+            const auto& distances = attrs.at("road_distances").AsMap();
+            stop.distances.reserve(distances.size());
+            for (const auto& [neighbour_stop, distance_node] : distances) {
+                stop.distances.emplace_back(neighbour_stop, distance_node.AsInt());
             }
         }
         return stop;
     }
 
-    int ComputeStopsDistance(const Stop& lhs, const Stop& rhs) {
-        if (auto it = lhs.distances.find(rhs.name); it != lhs.distances.end()) {
-            return it->second;
-        } else {
-            return rhs.distances.at(lhs.name);
-        }
-    }
-
     vector<string> ParseStops(const vector<Json::Node>& stop_nodes, bool is_roundtrip) {
         vector<string> stops;
         stops.reserve(stop_nodes.size());
@@ -85,4 +79,28 @@ namespace Descriptions {
         return queries;
     }
 
+    Memory::Usage GetMemoryUsage(const vector<InputQuery>& queries) {
+        Memory::Usage usage = Memory::GetVectorUsage(queries);
+        for (const InputQuery& query : queries) {
+            if (const auto* stop = get_if<Stop>(&query)) {
+                usage += Memory::GetStringUsage(stop->name) + Memory::GetVectorUsage(stop->distances);
+                for (const auto& [name, distance] : stop->distances) {
+                    usage += Memory::GetStringUsage(name);
+                }
+            } else {
+                const auto& bus = get<Bus>(query);
+                usage += Memory::GetStringUsage(bus.name)
+                    + Memory::GetVectorUsage(bus.stops)
+                    + Memory::GetVectorUsage(bus.endpoints);
+                for (const string& name : bus.stops) {
+                    usage += Memory::GetStringUsage(name);
+                }
+                for (const string& name : bus.endpoints) {
+                    usage += Memory::GetStringUsage(name);
+                }
+            }
+        }
+        return usage;
+    }
+
 }
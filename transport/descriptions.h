@@ -1,10 +1,11 @@
 #pragma once
 
 #include "json.h"
+#include "memory_usage.h"
 #include "sphere.h"
 
 #include <string>
-#include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -13,13 +14,11 @@ namespace Descriptions {
     struct Stop {
         std::string name;
         Sphere::Point position;
-        std::unordered_map<std::string, int> distances;
+        std::vector<std::pair<std::string, int>> distances;
 
         static Stop ParseFrom(const Json::Dict& attrs);
     };
 
-    int ComputeStopsDistance(const Stop& lhs, const Stop& rhs);
-
     struct Bus {
         std::string name;
         std::vector<std::string> stops;
@@ -32,6 +31,5 @@ namespace Descriptions {
 
     std::vector<InputQuery> ReadDescriptions(const std::vector<Json::Node>& nodes);
 
-    using StopsDict = std::unordered_map<std::string, const Stop*>;
-    using BusesDict = std::map<std::string, const Bus*>;
+    Memory::Usage GetMemoryUsage(const std::vector<InputQuery>& queries);
 }
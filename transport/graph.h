@@ -1,5 +1,6 @@
 #pragma once
 
+#include "memory_usage.h"
 #include "utils.h"
 
 #include <cstdlib>
@@ -33,6 +34,8 @@ namespace Graph {
         const Edge<Weight>& GetEdge(EdgeId edge_id) const;
         IncidentEdgesRange GetIncidentEdges(VertexId vertex) const;
 
+        Memory::Usage GetMemoryUsage() const;
+
     private:
         std::vector<Edge<Weight>> edges_;
         std::vector<IncidenceList> incidence_lists_;
@@ -71,4 +74,13 @@ namespace Graph {
         const auto& edges = incidence_lists_[vertex];
         return {std::begin(edges), std::end(edges)};
     }
+
+    template <typename Weight>
+    Memory::Usage DirectedWeightedGraph<Weight>::GetMemoryUsage() const {
+        Memory::Usage usage = Memory::GetVectorUsage(edges_) + Memory::GetVectorUsage(incidence_lists_);
+        for (const auto& incidence_list : incidence_lists_) {
+            usage += Memory::GetVectorUsage(incidence_list);
+        }
+        return usage;
+    }
 }
@@ -0,0 +1,110 @@
+#include "grid_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+GridIndex::GridIndex(Svg::Rect bounds, size_t item_count)
+    : bounds_(bounds)
+{
+    // about one item per cell
+    static constexpr size_t MAX_SIDE = 512;
+    const size_t side = clamp<size_t>(static_cast<size_t>(sqrt(static_cast<double>(item_count))), 1, MAX_SIDE);
+    columns_ = side;
+    rows_ = side;
+    cells_.resize(columns_ * rows_);
+}
+
+void GridIndex::Insert(uint32_t id, Svg::Rect box) {
+    const uint32_t entry_index = entries_.size();
+    entries_.push_back({id, box});
+    for (size_t row = GetRow(box.min.y); row <= GetRow(box.max.y); ++row) {
+        for (size_t column = GetColumn(box.min.x); column <= GetColumn(box.max.x); ++column) {
+            cells_[row * columns_ + column].push_back(entry_index);
+        }
+    }
+}
+
+void GridIndex::InsertSegment(uint32_t id, Svg::Point from, Svg::Point to, double half_width) {
+    const uint32_t entry_index = entries_.size();
+    entries_.push_back({id, {
+        {min(from.x, to.x) - half_width, min(from.y, to.y) - half_width},
+        {max(from.x, to.x) + half_width, max(from.y, to.y) + half_width},
+    }});
+    const double dy = to.y - from.y;
+    for (size_t row = GetRow(entries_.back().box.min.y); row <= GetRow(entries_.back().box.max.y); ++row) {
+        // the part of the segment within half_width of the row, widened
+        const auto [row_min_y, row_max_y] = GetRowSpan(row);
+        double t_begin = 0;
+        double t_end = 1;
+        if (dy != 0) {
+            const double t_min = (row_min_y - half_width - from.y) / dy;
+            const double t_max = (row_max_y + half_width - from.y) / dy;
+            t_begin = clamp(min(t_min, t_max), 0.0, 1.0);
+            t_end = clamp(max(t_min, t_max), 0.0, 1.0);
+        }
+        const double x_begin = from.x + (to.x - from.x) * t_begin;
+        const double x_end = from.x + (to.x - from.x) * t_end;
+        const size_t column_end = GetColumn(max(x_begin, x_end) + half_width);
+        for (size_t column = GetColumn(min(x_begin, x_end) - half_width); column <= column_end; ++column) {
+            cells_[row * columns_ + column].push_back(entry_index);
+        }
+    }
+}
+
+vector<uint32_t> GridIndex::Find(Svg::Rect box) const {
+    vector<uint32_t> ids;
+    for (size_t row = GetRow(box.min.y); row <= GetRow(box.max.y); ++row) {
+        for (size_t column = GetColumn(box.min.x); column <= GetColumn(box.max.x); ++column) {
+            for (const uint32_t entry_index : cells_[row * columns_ + column]) {
+                const Entry& entry = entries_[entry_index];
+                if (Intersects(entry.box, box)) {
+                    ids.push_back(entry.id);
+                }
+            }
+        }
+    }
+    sort(begin(ids), end(ids));
+    ids.erase(unique(begin(ids), end(ids)), end(ids));
+    return ids;
+}
+
+Memory::Usage GridIndex::GetMemoryUsage() const {
+    Memory::Usage usage = Memory::GetVectorUsage(entries_) + Memory::GetVectorUsage(cells_);
+    for (const auto& cell : cells_) {
+        usage += Memory::GetVectorUsage(cell);
+    }
+    return usage;
+}
+
+size_t GridIndex::GetColumn(double x) const {
+    const double width = bounds_.max.x - bounds_.min.x;
+    if (width <= 0) {
+        return 0;
+    }
+    const double column = floor((x - bounds_.min.x) / width * columns_);
+    return static_cast<size_t>(clamp(column, 0.0, static_cast<double>(columns_ - 1)));
+}
+
+size_t GridIndex::GetRow(double y) const {
+    const double height = bounds_.max.y - bounds_.min.y;
+    if (height <= 0) {
+        return 0;
+    }
+    const double row = floor((y - bounds_.min.y) / height * rows_);
+    return static_cast<size_t>(clamp(row, 0.0, static_cast<double>(rows_ - 1)));
+}
+
+pair<double, double> GridIndex::GetRowSpan(size_t row) const {
+    static constexpr double UNBOUNDED = numeric_limits<double>::infinity();
+    const double height = bounds_.max.y - bounds_.min.y;
+    if (height <= 0) {
+        return {-UNBOUNDED, UNBOUNDED};
+    }
+    return {
+        row == 0 ? -UNBOUNDED : bounds_.min.y + height * row / rows_,
+        row + 1 == rows_ ? UNBOUNDED : bounds_.min.y + height * (row + 1) / rows_,
+    };
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "memory_usage.h"
+#include "svg.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Uniform grid over a rectangle of the map. Every item is inserted with one
+// or more boxes it covers; a query returns the ids of items with a box that
+// meets the given one. Boxes beyond the bounds fall into the border cells.
+class GridIndex {
+public:
+    GridIndex() = default;
+    GridIndex(Svg::Rect bounds, size_t item_count);
+
+    void Insert(uint32_t id, Svg::Rect box);
+    // A segment widened by half_width on every side goes only into the
+    // cells it crosses, not into every cell of its bounding box
+    void InsertSegment(uint32_t id, Svg::Point from, Svg::Point to, double half_width);
+
+    // Sorted and without repeats
+    std::vector<uint32_t> Find(Svg::Rect box) const;
+
+    Memory::Usage GetMemoryUsage() const;
+
+private:
+    struct Entry {
+        uint32_t id;
+        Svg::Rect box;
+    };
+
+    size_t GetColumn(double x) const;
+    size_t GetRow(double y) const;
+    // The y range the row covers; the border rows extend to infinity
+    std::pair<double, double> GetRowSpan(size_t row) const;
+
+    Svg::Rect bounds_;
+    size_t columns_ = 1;
+    size_t rows_ = 1;
+    std::vector<Entry> entries_;
+    std::vector<std::vector<uint32_t>> cells_;  // entry indices, row by row
+};
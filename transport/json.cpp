@@ -53,7 +53,9 @@ namespace Json {
         string line;
         for (;;) {
             char c = input.get();
-            if (c == '\\') {
+            if (!input) {
+                break;
+            } else if (c == '\\') {
                 line.push_back('"');
                 input.get();
             } else if (c != '"') {
@@ -101,6 +103,17 @@ namespace Json {
         }
     }
 
+    bool operator==(const Raw& lhs, const Raw& rhs) {
+        auto join = [](const Raw& raw) {
+            string text;
+            for (const auto& part : raw.parts) {
+                text += *part;
+            }
+            return text;
+        };
+        return join(lhs) == join(rhs);
+    }
+
     bool operator==(const Node& lhs, const Node& rhs) {
         const auto& left = lhs.GetBase();
         const auto& right = rhs.GetBase();
@@ -121,15 +134,19 @@ namespace Json {
         return Document{LoadNode(input)};
     }
 
-    template <>
-    void PrintValue<string>(const string& value, ostream& output) {
-        output << '"';
+    void PrintEscaped(string_view value, ostream& output) {
         for (char c : value) {
             if (c == '"') {
                 output << '\\';
             }
             output << c;
         }
+    }
+
+    template <>
+    void PrintValue<string>(const string& value, ostream& output) {
+        output << '"';
+        PrintEscaped(value, output);
         output << '"';
     }
 
@@ -168,6 +185,13 @@ namespace Json {
         output << '}';
     }
 
+    template <>
+    void PrintValue<Raw>(const Raw& raw, ostream& output) {
+        for (const auto& part : raw.parts) {
+            output << *part;
+        }
+    }
+
     void PrintNode(const Json::Node& node, ostream& output) {
         visit([&output](const auto& value) { PrintValue(value, output); },
                 node.GetBase());
@@ -4,7 +4,9 @@
 
 #include <iostream>
 #include <map>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -14,7 +16,15 @@ namespace Json {
     class Node;
         using Dict = std::map<std::string, Node>;
 
-    class Node : std::variant<std::vector<Node>, Dict, bool, int, double, std::string> {
+    // Text that is already serialized JSON and is printed verbatim. It is
+    // a sequence of shared parts, so large ones are reused without copying
+    struct Raw {
+        std::vector<std::shared_ptr<const std::string>> parts;
+    };
+
+    bool operator==(const Raw&, const Raw&);
+
+    class Node : std::variant<std::vector<Node>, Dict, bool, int, double, std::string, Raw> {
     public:
         using variant::variant;
         const variant& GetBase() const { return *this; }
@@ -59,6 +69,9 @@ namespace Json {
         output << value;
     }
 
+    // The contents of a JSON string literal for value, without the quotes
+    void PrintEscaped(std::string_view value, std::ostream& output);
+
     template <>
     void PrintValue<std::string>(const std::string& value, std::ostream& output);
 
@@ -71,6 +84,9 @@ namespace Json {
     template <>
     void PrintValue<Dict>(const Dict& dict, std::ostream& output);
 
+    template <>
+    void PrintValue<Raw>(const Raw& raw, std::ostream& output);
+
     void Print(const Document& document, std::ostream& output);
 }
 
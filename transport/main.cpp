@@ -1,28 +1,198 @@
 #include "descriptions.h"
 #include "json.h"
+#include "metrics.h"
+#include "profile.h"
 #include "requests.h"
+#include "server.h"
+#include "shared_catalog.h"
 #include "sphere.h"
 #include "transport_catalog.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
 
 using namespace std;
 
-int main() {
-    const auto input_doc = Json::Load(cin);
-    const auto& input_map = input_doc.GetRoot().AsMap();
+struct Options {
+    bool serve = false;
+    bool estimate_memory = false;
+    TransportCatalog::Options catalog;
+    optional<string> catalog_path;
+    optional<string> socket_path;
+    size_t thread_count = thread::hardware_concurrency();
+    // Prometheus text dump, rewritten every metrics_period while serving
+    optional<string> metrics_path;
+    chrono::seconds metrics_period{10};
+};
+
+Options ParseOptions(const vector<string_view>& args) {
+    Options options;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string_view arg = args[i];
+        if (arg == "--serve") {
+            options.serve = true;
+            continue;
+        } else if (arg == "--estimate-memory") {
+            options.estimate_memory = true;
+            continue;
+        } else if (arg == "--prebuilt-responses") {
+            options.catalog.prebuilt_responses = true;
+            continue;
+        } else if (arg == "--profile") {
+            Profile::Enable();
+            continue;
+        }
+        if (i + 1 == args.size()) {
+            throw invalid_argument("missing value for " + string(arg));
+        }
+        const string value(args[++i]);
+        if (arg == "--catalog") {
+            options.catalog_path = value;
+        } else if (arg == "--socket") {
+            options.socket_path = value;
+        } else if (arg == "--threads") {
+            options.thread_count = stoul(value);
+        } else if (arg == "--route-cache-mb") {
+            options.catalog.route_cache_bytes = stoul(value) << 20;
+        } else if (arg == "--metrics-file") {
+            options.metrics_path = value;
+        } else if (arg == "--metrics-period") {
+            options.metrics_period = chrono::seconds(stoul(value));
+            // the dump would rewrite the file in a tight loop
+            if (options.metrics_period.count() == 0) {
+                throw invalid_argument("--metrics-period must be positive");
+            }
+        } else {
+            throw invalid_argument("unknown option " + string(arg));
+        }
+    }
+    return options;
+}
+
+Json::Document LoadDocument(istream& input) {
+    LOG_DURATION("parse input");
+    return Json::Load(input);
+}
+
+shared_ptr<const TransportCatalog> LoadCatalog(const Json::Dict& input_map, const TransportCatalog::Options& options) {
+    auto descriptions = [&input_map] {
+        LOG_DURATION("read descriptions");
+        return Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray());
+    }();
+    static auto& builds = Metrics::GetCounter("transport_catalog_builds_total", "Catalogs built");
+    static auto& build_seconds = Metrics::GetGauge(
+        "transport_catalog_build_seconds", "Time the last catalog took to build"
+    );
 
-    const TransportCatalog db(
-        Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray()),
+    LOG_DURATION("build catalog");
+    const auto start = chrono::steady_clock::now();
+    auto catalog = make_shared<const TransportCatalog>(
+        move(descriptions),
         input_map.at("routing_settings").AsMap(),
-        input_map.at("render_settings").AsMap()
+        input_map.at("render_settings").AsMap(),
+        options
+    );
+    builds.Add();
+    build_seconds.Set(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    return catalog;
+}
+
+shared_ptr<const TransportCatalog> LoadCatalogFile(const string& path, const TransportCatalog::Options& options) {
+    ifstream input(path);
+    if (!input) {
+        throw runtime_error("cannot open " + path);
+    }
+    return LoadCatalog(LoadDocument(input).GetRoot().AsMap(), options);
+}
+
+int Serve(const Options& options) {
+    SharedCatalog catalog(
+        options.catalog_path
+            ? LoadCatalogFile(*options.catalog_path, options.catalog)
+            : LoadCatalog(LoadDocument(cin).GetRoot().AsMap(), options.catalog)
     );
+    // declared after catalog, so that it is stopped before catalog goes
+    optional<Server::HangupReloader> reloader;
+    if (options.catalog_path) {
+        reloader.emplace(catalog, [path = *options.catalog_path, catalog_options = options.catalog] {
+            return LoadCatalogFile(path, catalog_options);
+        });
+    }
+
+    // started after the reload thread, so that SIGHUP is blocked here too
+    if (options.metrics_path) {
+        Metrics::StartPrometheusDump(*options.metrics_path, options.metrics_period);
+    }
+
+    if (options.socket_path) {
+        Server::ServeSocket(catalog, *options.socket_path, options.thread_count);
+    } else {
+        Server::ServeStream(catalog, cin, cout);
+    }
+    if (options.metrics_path) {
+        Metrics::WritePrometheus(*options.metrics_path);
+    }
+    if (Profile::IsEnabled()) {
+        Profile::PrintReport(cerr);
+    }
+    return 0;
+}
+
+// Pre-flight check that reads the input but builds nothing: the memory the
+// descriptions and the all-pairs routing table take, and the router engine
+// the routing settings lead to
+int EstimateMemory(const Json::Dict& input_map) {
+    const auto descriptions = Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray());
+    const size_t stop_count = count_if(begin(descriptions), end(descriptions), [](const auto& query) {
+        return holds_alternative<Descriptions::Stop>(query);
+    });
+    cout << "descriptions: " << Descriptions::GetMemoryUsage(descriptions).bytes << " bytes" << endl;
+    try {
+        const auto plan = TransportRouter::PlanEngine(stop_count, input_map.at("routing_settings").AsMap());
+        cout << "all-pairs routing table: " << plan.all_pairs_bytes << " bytes, limit "
+             << plan.memory_limit << " bytes" << endl;
+        cout << "router engine: "
+             << (plan.engine == Graph::RouterEngine::AllPairs ? "all_pairs" : "dijkstra") << endl;
+    } catch (const length_error& e) {
+        cout << "refused: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    const Options options = ParseOptions({argv + 1, argv + argc});
+    if (options.serve) {
+        return Serve(options);
+    }
+
+    const auto input_doc = LoadDocument(cin);
+    const auto& input_map = input_doc.GetRoot().AsMap();
+    if (options.estimate_memory) {
+        return EstimateMemory(input_map);
+    }
+
+    const auto db = LoadCatalog(input_map, options.catalog);
 
     Json::PrintValue(
-        Requests::ProcessAll(db, input_map.at("stat_requests").AsArray()),
+        Requests::ProcessAll(*db, input_map.at("stat_requests").AsArray()),
         cout
     );
     cout << endl;
+    if (options.metrics_path) {
+        Metrics::WritePrometheus(*options.metrics_path);
+    }
+    if (Profile::IsEnabled()) {
+        Profile::PrintReport(cerr);
+    }
     return 0;
 }
@@ -1,9 +1,12 @@
 #include "map_renderer.h"
+#include "deadline.h"
 #include "sphere_projection.h"
 
 #include <algorithm>
+#include <cmath>
+#include <future>
+#include <numeric>
 using namespace std;
-using namespace Descriptions;
 
 Svg::Point ParsePoint(const Json::Node& json) {
     const auto& array = json.AsArray();
@@ -39,30 +42,33 @@ vector<Svg::Color> ParseColors(const Json::Node& json) {
 }
 
 
-MapRenderer::MapRenderer(const StopsDict& stops_dict,
-                         const BusesDict& buses_dict,
+MapRenderer::MapRenderer(const Network::Model& network,
                          const Json::Dict& render_settings_json)
     : render_settings_(MakeRenderSettings(render_settings_json)),
-      buses_dict_(buses_dict),
-      stops_coords_(ComputeStopsCoords(stops_dict)),
-      bus_colors_(ChooseBusColors())
+      network_(network),
+      stops_coords_(ComputeStopsCoords()),
+      bus_colors_(ChooseBusColors()),
+      stops_index_(BuildStopsIndex()),
+      buses_index_(BuildBusesIndex())
 {}
 
-unordered_map<string, Svg::Color> MapRenderer::ChooseBusColors() const {
+vector<Svg::Color> MapRenderer::ChooseBusColors() const {
     const auto& palette = render_settings_.palette;
-    unordered_map<std::string, Svg::Color> bus_colors;
-    int idx = 0;
-    for (const auto& [bus_name, bus_ptr] : buses_dict_) {
-        bus_colors[bus_name] = palette[idx++ % palette.size()];
+    const size_t bus_count = network_.GetBuses().size();
+    vector<Svg::Color> bus_colors;
+    bus_colors.reserve(bus_count);
+    for (size_t idx = 0; idx < bus_count; ++idx) {
+        bus_colors.push_back(palette[idx % palette.size()]);
     }
     return bus_colors;
 }
 
-map<string, Svg::Point> MapRenderer::ComputeStopsCoords(const StopsDict& stops_dict) const {
+vector<Svg::Point> MapRenderer::ComputeStopsCoords() const {
+    const auto& stops = network_.GetStops();
     vector<Sphere::Point> points;
-    points.reserve(stops_dict.size());
-    for (const auto& [_, stop_ptr] : stops_dict) {
-        points.push_back(stop_ptr->position);
+    points.reserve(stops.size());
+    for (const auto& stop : stops) {
+        points.push_back(stop.position);
     }
 
     const double max_width = render_settings_.width;
@@ -74,9 +80,10 @@ map<string, Svg::Point> MapRenderer::ComputeStopsCoords(const StopsDict& stops_d
         max_width, max_height, padding
     );
     
-    map<string, Svg::Point> stops_coords;
-    for (const auto& [stop_name, stop_ptr] : stops_dict) {
-        stops_coords[stop_name] = projector(stop_ptr->position);
+    vector<Svg::Point> stops_coords;
+    stops_coords.reserve(points.size());
+    for (const auto& point : points) {
+        stops_coords.push_back(projector(point));
     }
 
     return stops_coords;
@@ -104,110 +111,390 @@ MapRenderer::RenderSettings MapRenderer::MakeRenderSettings(const Json::Dict& js
         render_settings.layers.push_back(layer_node.AsString());
     }
 
+    if (json.count("style_classes") > 0 && json.at("style_classes").AsBool()) {
+        render_settings.style_mode = Svg::StyleMode::Classes;
+    }
+    if (json.count("polyline_tolerance") > 0) {
+        render_settings.polyline_tolerance = json.at("polyline_tolerance").AsDouble();
+    }
+
     return render_settings;
 }
 
-void MapRenderer::RenderBusLines(Svg::Document& svg) const {
-    for (const auto& [bus_name, bus_ptr] : buses_dict_) {
-        const auto& stops = bus_ptr->stops;
+void MapRenderer::RenderBusLines(Svg::Document& svg, Ids bus_ids, uint32_t zoom) const {
+    const auto& buses = network_.GetBuses();
+    const BusLines* simplified_lines = render_settings_.polyline_tolerance > 0 ? &GetBusLines(zoom) : nullptr;
+    for (const Network::BusId bus_id : bus_ids) {
+        Deadline::CheckActive();
+        const auto& stops = buses[bus_id].stops;
         if (stops.empty()) {
             continue;
         }
 
         Svg::Polyline line;
-        line.SetStrokeColor(bus_colors_.at(bus_name))
+        line.SetStrokeColor(bus_colors_[bus_id])
             .SetStrokeWidth(render_settings_.line_width)
             .SetStrokeLineCap("round")
             .SetStrokeLineJoin("round");
 
-        for (const auto& stop : stops) {
-            line.AddPoint(stops_coords_.at(stop));
+        if (simplified_lines) {
+            for (const Svg::Point point : (*simplified_lines)[bus_id]) {
+                line.AddPoint(point);
+            }
+        } else {
+            for (const Network::StopId stop_id : stops) {
+                line.AddPoint(stops_coords_[stop_id]);
+            }
         }
 
         svg.Add(line);
     }
 }
 
-void MapRenderer::RenderStopPoints(Svg::Document& svg) const {
-    for (const auto& [stop_name, stop_point] : stops_coords_) {
-        svg.Add(
-            Svg::Circle{}
-            .SetCenter(stop_point)
-            .SetRadius(render_settings_.stop_radius)
-            .SetFillColor("white")
-        );
+double ComputeSegmentDistance(Svg::Point point, Svg::Point begin, Svg::Point end) {
+    const double dx = end.x - begin.x;
+    const double dy = end.y - begin.y;
+    const double length_squared = dx * dx + dy * dy;
+    double t = 0;
+    if (length_squared > 0) {
+        t = clamp(((point.x - begin.x) * dx + (point.y - begin.y) * dy) / length_squared, 0.0, 1.0);
     }
+    return hypot(point.x - (begin.x + t * dx), point.y - (begin.y + t * dy));
+}
+
+// Douglas-Peucker: keeps the ends and, while some point is farther than
+// tolerance from the segment between its kept neighbours, the farthest one
+vector<Svg::Point> SimplifyPolyline(const vector<Svg::Point>& points, double tolerance) {
+    if (points.size() <= 2) {
+        return points;
+    }
+    vector<bool> kept(points.size(), false);
+    kept.front() = kept.back() = true;
+    vector<pair<size_t, size_t>> ranges = {{0, points.size() - 1}};
+    while (!ranges.empty()) {
+        const auto [first, last] = ranges.back();
+        ranges.pop_back();
+        double max_distance = 0;
+        size_t farthest = first;
+        for (size_t i = first + 1; i < last; ++i) {
+            const double distance = ComputeSegmentDistance(points[i], points[first], points[last]);
+            if (distance > max_distance) {
+                max_distance = distance;
+                farthest = i;
+            }
+        }
+        if (max_distance > tolerance) {
+            kept[farthest] = true;
+            ranges.push_back({first, farthest});
+            ranges.push_back({farthest, last});
+        }
+    }
+
+    vector<Svg::Point> result;
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (kept[i]) {
+            result.push_back(points[i]);
+        }
+    }
+    return result;
+}
+
+const MapRenderer::BusLines& MapRenderer::GetBusLines(uint32_t zoom) const {
+    call_once(bus_lines_flags_[zoom], [this, zoom] {
+        const double tolerance = render_settings_.polyline_tolerance / (1u << zoom);
+        const auto& buses = network_.GetBuses();
+        BusLines lines;
+        lines.reserve(buses.size());
+        for (const auto& bus : buses) {
+            vector<Svg::Point> points;
+            points.reserve(bus.stops.size());
+            for (const Network::StopId stop_id : bus.stops) {
+                points.push_back(stops_coords_[stop_id]);
+            }
+            lines.push_back(SimplifyPolyline(points, tolerance));
+        }
+        bus_lines_[zoom] = move(lines);
+    });
+    return bus_lines_[zoom];
 }
 
-void MapRenderer::RenderStopLabels(Svg::Document& svg) const {
-    for (const auto& [stop_name, stop_point] : stops_coords_) {
-        const auto label =
-            Svg::Text{}
-            .SetPoint(stop_point)
-            .SetOffset(render_settings_.stop_label_offset)
-            .SetFontSize(render_settings_.stop_label_font_size)
-            .SetFontFamily("Verdana")
-            .SetData(stop_name);
+void MapRenderer::AddStopPoint(Svg::Document& svg, Network::StopId stop_id) const {
+    svg.Add(
+        Svg::Circle{}
+        .SetCenter(stops_coords_[stop_id])
+        .SetRadius(render_settings_.stop_radius)
+        .SetFillColor("white")
+    );
+}
+
+void MapRenderer::AddStopLabel(Svg::Document& svg, Network::StopId stop_id) const {
+    const auto label =
+        Svg::Text{}
+        .SetPoint(stops_coords_[stop_id])
+        .SetOffset(render_settings_.stop_label_offset)
+        .SetFontSize(render_settings_.stop_label_font_size)
+        .SetFontFamily("Verdana")
+        .SetData(network_.GetStop(stop_id).name);
+
+    svg.Add(
+        Svg::Text{label}
+        .SetFillColor(render_settings_.underlayer_color)
+        .SetStrokeColor(render_settings_.underlayer_color)
+        .SetStrokeWidth(render_settings_.underlayer_width)
+        .SetStrokeLineCap("round")
+        .SetStrokeLineJoin("round")
+    );
+    svg.Add(
+        Svg::Text(label)
+        .SetFillColor("black")
+    );
+}
+
+void MapRenderer::AddBusLabel(Svg::Document& svg, Network::BusId bus_id, Network::StopId stop_id) const {
+    const auto base_text =
+        Svg::Text{}
+        .SetPoint(stops_coords_[stop_id])
+        .SetOffset(render_settings_.bus_label_offset)
+        .SetFontSize(render_settings_.bus_label_font_size)
+        .SetFontFamily("Verdana")
+        .SetFontWeight("bold")
+        .SetData(network_.GetBus(bus_id).name);
+    svg.Add(
+        Svg::Text(base_text)
+        .SetFillColor(render_settings_.underlayer_color)
+        .SetStrokeColor(render_settings_.underlayer_color)
+        .SetStrokeWidth(render_settings_.underlayer_width)
+        .SetStrokeLineCap("round").SetStrokeLineJoin("round")
+    );
+    svg.Add(
+        Svg::Text(base_text)
+        .SetFillColor(bus_colors_[bus_id])
+    );
+}
 
-        svg.Add(
-            Svg::Text{label}
-            .SetFillColor(render_settings_.underlayer_color)
-            .SetStrokeColor(render_settings_.underlayer_color)
-            .SetStrokeWidth(render_settings_.underlayer_width)
+void MapRenderer::RenderStopPoints(Svg::Document& svg, Ids stop_ids, uint32_t) const {
+    for (const Network::StopId stop_id : stop_ids) {
+        AddStopPoint(svg, stop_id);
+    }
+}
+
+void MapRenderer::RenderStopLabels(Svg::Document& svg, Ids stop_ids, uint32_t) const {
+    for (const Network::StopId stop_id : stop_ids) {
+        AddStopLabel(svg, stop_id);
+    }
+}
+
+void MapRenderer::RenderBusLabels(Svg::Document& svg, Ids bus_ids, uint32_t) const {
+    for (const Network::BusId bus_id : bus_ids) {
+        for (const Network::StopId endpoint : network_.GetBus(bus_id).endpoints) {
+            AddBusLabel(svg, bus_id, endpoint);
+        }
+    }
+}
+
+void MapRenderer::RenderRouteBusLines(Svg::Document& svg, const Rides& rides) const {
+    for (const auto& ride : rides) {
+        const auto& stops = network_.GetBus(ride.bus_id).stops;
+        Svg::Polyline line;
+        line.SetStrokeColor(bus_colors_[ride.bus_id])
+            .SetStrokeWidth(render_settings_.line_width)
             .SetStrokeLineCap("round")
-            .SetStrokeLineJoin("round")
-        );
-        svg.Add(
-            Svg::Text(label)
-            .SetFillColor("black")
-        );
-    }
-}
-
-void MapRenderer::RenderBusLabels(Svg::Document& svg) const {
-    for (const auto& [bus_name, bus_ptr] : buses_dict_) {
-        const auto& stops = bus_ptr->stops;
-        const auto& color = bus_colors_.at(bus_name);
-        for (const string& endpoint : bus_ptr->endpoints) {
-            const auto point = stops_coords_.at(endpoint);
-            const auto base_text =
-                Svg::Text{}
-                .SetPoint(point)
-                .SetOffset(render_settings_.bus_label_offset)
-                .SetFontSize(render_settings_.bus_label_font_size)
-                .SetFontFamily("Verdana")
-                .SetFontWeight("bold")
-                .SetData(bus_name);
-            svg.Add(
-                Svg::Text(base_text)
-                .SetFillColor(render_settings_.underlayer_color)
-                .SetStrokeColor(render_settings_.underlayer_color)
-                .SetStrokeWidth(render_settings_.underlayer_width)
-                .SetStrokeLineCap("round").SetStrokeLineJoin("round")
-            );
-            svg.Add(
-                Svg::Text(base_text)
-                .SetFillColor(color)
-            );
+            .SetStrokeLineJoin("round");
+        for (size_t i = ride.start_stop_index; i <= ride.start_stop_index + ride.span_count; ++i) {
+            line.AddPoint(stops_coords_[stops[i]]);
+        }
+        svg.Add(line);
+    }
+}
+
+void MapRenderer::RenderRouteBusLabels(Svg::Document& svg, const Rides& rides) const {
+    for (const auto& ride : rides) {
+        const auto& bus = network_.GetBus(ride.bus_id);
+        for (const size_t i : {ride.start_stop_index, ride.start_stop_index + ride.span_count}) {
+            const Network::StopId stop_id = bus.stops[i];
+            if (find(begin(bus.endpoints), end(bus.endpoints), stop_id) != end(bus.endpoints)) {
+                AddBusLabel(svg, ride.bus_id, stop_id);
+            }
+        }
+    }
+}
+
+void MapRenderer::RenderRouteStopPoints(Svg::Document& svg, const Rides& rides) const {
+    for (const auto& ride : rides) {
+        const auto& stops = network_.GetBus(ride.bus_id).stops;
+        for (size_t i = ride.start_stop_index; i <= ride.start_stop_index + ride.span_count; ++i) {
+            AddStopPoint(svg, stops[i]);
         }
     }
 }
 
-Svg::Document MapRenderer::Render() const {
+void MapRenderer::RenderRouteStopLabels(Svg::Document& svg, const Rides& rides) const {
+    for (const auto& ride : rides) {
+        AddStopLabel(svg, network_.GetBus(ride.bus_id).stops[ride.start_stop_index]);
+    }
+    if (!rides.empty()) {
+        const auto& last_ride = rides.back();
+        AddStopLabel(svg, network_.GetBus(last_ride.bus_id).stops[last_ride.start_stop_index + last_ride.span_count]);
+    }
+}
+
+vector<uint32_t> MakeIds(size_t count) {
+    vector<uint32_t> ids(count);
+    iota(begin(ids), end(ids), 0);
+    return ids;
+}
+
+Svg::Document MapRenderer::Render(ThreadPool& pool) const {
+    // below this many items a range is not worth a task of its own
+    static constexpr size_t MIN_CHUNK_SIZE = 256;
+
+    const vector<uint32_t> stop_ids = MakeIds(network_.GetStops().size());
+    const vector<uint32_t> bus_ids = MakeIds(network_.GetBuses().size());
+
+    vector<future<Svg::Document>> parts;
+    for (const auto& layer : render_settings_.layers) {
+        const LayerAction& action = layer_actions.at(layer);
+        const Ids ids = action.over_stops ? stop_ids : bus_ids;
+        const size_t chunk_size = max(MIN_CHUNK_SIZE, ids.size() / (pool.GetThreadCount() * 4));
+        for (size_t chunk_begin = 0; chunk_begin < ids.size(); chunk_begin += chunk_size) {
+            const Ids chunk = ids.subspan(chunk_begin, min(chunk_size, ids.size() - chunk_begin));
+            parts.push_back(pool.Submit([this, &action, chunk] {
+                Svg::Document part;
+                part.SetStyleMode(render_settings_.style_mode);
+                (this->*action.render)(part, chunk, 0);
+                return part;
+            }));
+        }
+    }
+
     Svg::Document svg;
+    svg.SetStyleMode(render_settings_.style_mode);
+    for (auto& part : parts) {
+        svg.Append(part.get());
+    }
+    return svg;
+}
+
+Svg::Document MapRenderer::RenderRoute(const TransportRouter::RouteInfo& route) const {
+    Rides rides;
+    for (const auto& item : route.items) {
+        if (const auto* ride = get_if<TransportRouter::RouteInfo::BusItem>(&item)) {
+            rides.push_back(*ride);
+        }
+    }
+
+    Svg::Document svg;
+    if (rides.empty()) {
+        return svg;
+    }
+    svg.Add(
+        Svg::Polyline{}
+        .AddPoint({0, 0})
+        .AddPoint({render_settings_.width, 0})
+        .AddPoint({render_settings_.width, render_settings_.height})
+        .AddPoint({0, render_settings_.height})
+        .SetFillColor(render_settings_.underlayer_color)
+    );
     for (const auto& layer : render_settings_.layers) {
-        (this->*layer_actions.at(layer))(svg);
-        /*const auto& layer = layer_node.AsString();
-        if (layer == "bus_lines") {
-            RenderBusLines(svg);
-        } else if (layer == "bus_labels") {
-            RenderBusLabels(svg);
-        } else if (layer == "stop_points") {
-            RenderStopPoints(svg);
-        } else if (layer == "stop_labels") {
-            RenderStopLabels(svg);
-        }*/
+        Deadline::CheckActive();
+        (this->*layer_actions.at(layer).render_route)(svg, rides);
+    }
+    return svg;
+}
+
+Memory::Usage MapRenderer::GetMemoryUsage() const {
+    Memory::Usage usage = Memory::GetVectorUsage(stops_coords_)
+        + Memory::GetVectorUsage(bus_colors_)
+        + stops_index_.GetMemoryUsage()
+        + buses_index_.GetMemoryUsage();
+    for (const auto& color : bus_colors_) {
+        usage += Svg::GetColorMemoryUsage(color);
+    }
+    return usage;
+}
+
+bool MapRenderer::HasTile(uint32_t zoom, uint32_t x, uint32_t y) {
+    return zoom <= MAX_TILE_ZOOM && x < (1u << zoom) && y < (1u << zoom);
+}
+
+optional<Svg::Document> MapRenderer::RenderTile(uint32_t zoom, uint32_t x, uint32_t y) const {
+    if (!HasTile(zoom, x, y)) {
+        return nullopt;
     }
+    const double tile_width = render_settings_.width / (1u << zoom);
+    const double tile_height = render_settings_.height / (1u << zoom);
+    const Svg::Rect tile{
+        {x * tile_width, y * tile_height},
+        {(x + 1) * tile_width, (y + 1) * tile_height},
+    };
 
+    const vector<uint32_t> stop_ids = stops_index_.Find(tile);
+    const vector<uint32_t> bus_ids = buses_index_.Find(tile);
+
+    Svg::Document svg;
+    svg.SetStyleMode(render_settings_.style_mode);
+    svg.SetViewBox(tile);
+    for (const auto& layer : render_settings_.layers) {
+        Deadline::CheckActive();
+        const LayerAction& action = layer_actions.at(layer);
+        (this->*action.render)(svg, action.over_stops ? stop_ids : bus_ids, zoom);
+    }
     return svg;
-}
\ No newline at end of file
+}
+
+Svg::Rect MapRenderer::EstimateLabelExtent(Svg::Point point, Svg::Point offset,
+                                           int font_size, string_view text) const {
+    // Glyphs are taken as wide as 0.7em and the text as reaching one em
+    // above the baseline and 0.3em below it; a byte counts as a glyph
+    static constexpr double GLYPH_WIDTH = 0.7;
+    static constexpr double DESCENT = 0.3;
+
+    const double stroke = render_settings_.underlayer_width / 2;
+    const Svg::Point origin{point.x + offset.x, point.y + offset.y};
+    return {
+        {origin.x - stroke, origin.y - font_size - stroke},
+        {origin.x + GLYPH_WIDTH * font_size * text.size() + stroke, origin.y + DESCENT * font_size + stroke},
+    };
+}
+
+Svg::Rect MakeBox(Svg::Point center, double radius) {
+    return {{center.x - radius, center.y - radius}, {center.x + radius, center.y + radius}};
+}
+
+GridIndex MapRenderer::BuildStopsIndex() const {
+    const auto& stops = network_.GetStops();
+    GridIndex index({{0, 0}, {render_settings_.width, render_settings_.height}}, stops.size());
+    for (Network::StopId stop_id = 0; stop_id < stops.size(); ++stop_id) {
+        const Svg::Point point = stops_coords_[stop_id];
+        index.Insert(stop_id, Svg::Union(
+            MakeBox(point, render_settings_.stop_radius),
+            EstimateLabelExtent(point, render_settings_.stop_label_offset,
+                                render_settings_.stop_label_font_size, stops[stop_id].name)
+        ));
+    }
+    return index;
+}
+
+GridIndex MapRenderer::BuildBusesIndex() const {
+    const auto& buses = network_.GetBuses();
+    size_t segment_count = 0;
+    for (const auto& bus : buses) {
+        segment_count += bus.stops.size();
+    }
+    GridIndex index({{0, 0}, {render_settings_.width, render_settings_.height}}, segment_count);
+    // simplified lines stray from the segments by up to the tolerance
+    const double half_width = render_settings_.line_width / 2 + render_settings_.polyline_tolerance;
+    for (Network::BusId bus_id = 0; bus_id < buses.size(); ++bus_id) {
+        const auto& bus = buses[bus_id];
+        for (size_t i = 0; i < bus.stops.size(); ++i) {
+            const Svg::Point to = stops_coords_[bus.stops[i]];
+            const Svg::Point from = i > 0 ? stops_coords_[bus.stops[i - 1]] : to;
+            index.InsertSegment(bus_id, from, to, half_width);
+        }
+        for (const Network::StopId endpoint : bus.endpoints) {
+            index.Insert(bus_id, EstimateLabelExtent(stops_coords_[endpoint], render_settings_.bus_label_offset,
+                                                     render_settings_.bus_label_font_size, bus.name));
+        }
+    }
+    return index;
+}
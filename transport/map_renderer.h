@@ -1,15 +1,44 @@
 #pragma once
+#include "grid_index.h"
 #include "json.h"
 #include "sphere.h"
-#include "descriptions.h"
+#include "network.h"
+#include "thread_pool.h"
+#include "transport_router.h"
+
+#include <array>
+#include <mutex>
+#include <optional>
+#include <span>
 
 class MapRenderer {
 public:
-    MapRenderer(const Descriptions::StopsDict& stops_dict,
-                const Descriptions::BusesDict& buses_dict,
+    MapRenderer(const Network::Model& network,
                 const Json::Dict& render_settings_json);
 
-    Svg::Document Render() const;
+    // Layers are split into ranges of stops or buses that are drawn on the
+    // pool concurrently, then joined in the configured order
+    Svg::Document Render(ThreadPool& pool) const;
+
+    // Zoom z splits the map into 2^z by 2^z tiles; x and y count from the
+    // top left one. Only stops and buses whose drawing may reach the tile
+    // are included, and the document's viewBox is the tile.
+    // nullopt if there is no such tile. Checks the active deadline between
+    // layers and bus lines.
+    std::optional<Svg::Document> RenderTile(uint32_t zoom, uint32_t x, uint32_t y) const;
+
+    static constexpr uint32_t MAX_TILE_ZOOM = 20;
+    static bool HasTile(uint32_t zoom, uint32_t x, uint32_t y);
+
+    // Objects to draw over the full map to show a route: the map is veiled
+    // with the underlayer color, then the rides are drawn by the same
+    // layers, with stop labels at transfers. Always in inline style, since
+    // they go after the map's own style block. Checks the active deadline
+    // between layers.
+    Svg::Document RenderRoute(const TransportRouter::RouteInfo& route) const;
+
+    // Not counting the bus lines simplified on demand for tiles
+    Memory::Usage GetMemoryUsage() const;
 private:
     struct RenderSettings {
         double width = 0.0;
@@ -25,26 +54,65 @@ private:
         int bus_label_font_size = 0;
         Svg::Point bus_label_offset;
         std::vector<std::string> layers;
+        Svg::StyleMode style_mode = Svg::StyleMode::Inline;
+        // Bus lines deviate from the stops by at most this many pixels
+        double polyline_tolerance = 0.0;
     };
 
     static RenderSettings MakeRenderSettings(const Json::Dict&);
-    std::map<std::string, Svg::Point> ComputeStopsCoords(const Descriptions::StopsDict&) const;
-    std::unordered_map<std::string, Svg::Color> ChooseBusColors() const;
-
-    void RenderBusLines(Svg::Document&) const;
-    void RenderBusLabels(Svg::Document&) const;
-    void RenderStopPoints(Svg::Document&) const;
-    void RenderStopLabels(Svg::Document&) const;
-
-    inline static const std::unordered_map<std::string, void (MapRenderer::*)(Svg::Document&) const> layer_actions = {
-        {"bus_lines",   &MapRenderer::RenderBusLines},
-        {"bus_labels",  &MapRenderer::RenderBusLabels},
-        {"stop_points", &MapRenderer::RenderStopPoints},
-        {"stop_labels", &MapRenderer::RenderStopLabels},
+    std::vector<Svg::Point> ComputeStopsCoords() const;
+    std::vector<Svg::Color> ChooseBusColors() const;
+
+    // Rough bounds of what is drawn for an item, labels included
+    Svg::Rect EstimateLabelExtent(Svg::Point point, Svg::Point offset,
+                                  int font_size, std::string_view text) const;
+    GridIndex BuildStopsIndex() const;
+    GridIndex BuildBusesIndex() const;
+
+    // Bus lines simplified to polyline_tolerance at a zoom level, where a
+    // map unit takes 2^zoom pixels; computed on first use
+    using BusLines = std::vector<std::vector<Svg::Point>>;  // by BusId
+    const BusLines& GetBusLines(uint32_t zoom) const;
+
+    // Each layer draws the items with the given ids, in that order, for a
+    // zoom level
+    using Ids = std::span<const uint32_t>;
+    void RenderBusLines(Svg::Document&, Ids bus_ids, uint32_t zoom) const;
+    void RenderBusLabels(Svg::Document&, Ids bus_ids, uint32_t zoom) const;
+    void RenderStopPoints(Svg::Document&, Ids stop_ids, uint32_t zoom) const;
+    void RenderStopLabels(Svg::Document&, Ids stop_ids, uint32_t zoom) const;
+
+    // The same layers for the rides of a route
+    using Rides = std::vector<TransportRouter::RouteInfo::BusItem>;
+    void RenderRouteBusLines(Svg::Document&, const Rides& rides) const;
+    void RenderRouteBusLabels(Svg::Document&, const Rides& rides) const;
+    void RenderRouteStopPoints(Svg::Document&, const Rides& rides) const;
+    void RenderRouteStopLabels(Svg::Document&, const Rides& rides) const;
+
+    void AddBusLabel(Svg::Document&, Network::BusId bus_id, Network::StopId stop_id) const;
+    void AddStopPoint(Svg::Document&, Network::StopId stop_id) const;
+    void AddStopLabel(Svg::Document&, Network::StopId stop_id) const;
+
+    struct LayerAction {
+        void (MapRenderer::*render)(Svg::Document&, Ids, uint32_t) const;
+        bool over_stops;  // otherwise over buses
+        void (MapRenderer::*render_route)(Svg::Document&, const Rides&) const;
+    };
+
+    inline static const std::unordered_map<std::string, LayerAction> layer_actions = {
+        {"bus_lines",   {&MapRenderer::RenderBusLines, false, &MapRenderer::RenderRouteBusLines}},
+        {"bus_labels",  {&MapRenderer::RenderBusLabels, false, &MapRenderer::RenderRouteBusLabels}},
+        {"stop_points", {&MapRenderer::RenderStopPoints, true, &MapRenderer::RenderRouteStopPoints}},
+        {"stop_labels", {&MapRenderer::RenderStopLabels, true, &MapRenderer::RenderRouteStopLabels}},
     };
 
     const RenderSettings render_settings_;
-    const Descriptions::BusesDict& buses_dict_;
-    const std::map<std::string, Svg::Point> stops_coords_;
-    const std::unordered_map<std::string, Svg::Color> bus_colors_;
+    const Network::Model& network_;
+    const std::vector<Svg::Point> stops_coords_;  // by StopId
+    const std::vector<Svg::Color> bus_colors_;  // by BusId
+    const GridIndex stops_index_;
+    const GridIndex buses_index_;
+
+    mutable std::array<std::once_flag, MAX_TILE_ZOOM + 1> bus_lines_flags_;
+    mutable std::array<BusLines, MAX_TILE_ZOOM + 1> bus_lines_;
 };
\ No newline at end of file
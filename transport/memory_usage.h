@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Estimates of the heap memory held by containers, from their sizes rather
+// than by hooking the allocator: bytes asked of the allocator, its own
+// overhead aside, and the number of blocks. The Get*Usage functions count
+// the container itself and not what its items hold in turn.
+namespace Memory {
+
+    struct Usage {
+        size_t bytes = 0;
+        size_t allocations = 0;
+
+        Usage& operator+=(const Usage& other) {
+            bytes += other.bytes;
+            allocations += other.allocations;
+            return *this;
+        }
+    };
+
+    inline Usage operator+(Usage lhs, const Usage& rhs) {
+        return lhs += rhs;
+    }
+
+    // Usage by component name, in the order components are reported
+    using Report = std::vector<std::pair<std::string, Usage>>;
+
+    template <typename Item>
+    Usage GetVectorUsage(const std::vector<Item>& items) {
+        return {items.capacity() * sizeof(Item), items.capacity() > 0 ? size_t{1} : 0};
+    }
+
+    inline Usage GetStringUsage(const std::string& str) {
+        // short strings live in the object itself
+        static const size_t inline_capacity = std::string().capacity();
+        return str.capacity() > inline_capacity ? Usage{str.capacity() + 1, 1} : Usage{};
+    }
+
+    // A node per item holding the value, the next pointer and the cached
+    // hash, plus the bucket array
+    template <typename Value, typename... Rest>
+    Usage GetHashTableUsage(const std::unordered_set<Value, Rest...>& table) {
+        constexpr size_t node_size = sizeof(Value) + 2 * sizeof(void*);
+        return {table.size() * node_size + table.bucket_count() * sizeof(void*), table.size() + 1};
+    }
+
+    template <typename Key, typename Value, typename... Rest>
+    Usage GetHashTableUsage(const std::unordered_map<Key, Value, Rest...>& table) {
+        constexpr size_t node_size = sizeof(std::pair<const Key, Value>) + 2 * sizeof(void*);
+        return {table.size() * node_size + table.bucket_count() * sizeof(void*), table.size() + 1};
+    }
+}
@@ -0,0 +1,201 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace Metrics {
+
+    const chrono::steady_clock::time_point START_TIME = chrono::steady_clock::now();
+
+    size_t GetThreadShard(size_t shard_count) {
+        static atomic<size_t> next_shard = 0;
+        thread_local const size_t shard = next_shard.fetch_add(1, memory_order_relaxed);
+        return shard % shard_count;
+    }
+
+    void Counter::Add(uint64_t value) {
+        shards_[GetThreadShard(SHARD_COUNT)].value.fetch_add(value, memory_order_relaxed);
+    }
+
+    uint64_t Counter::Get() const {
+        uint64_t total = 0;
+        for (const Shard& shard : shards_) {
+            total += shard.value.load(memory_order_relaxed);
+        }
+        return total;
+    }
+
+    void Gauge::Set(double value) {
+        value_.store(value, memory_order_relaxed);
+    }
+
+    double Gauge::Get() const {
+        return value_.load(memory_order_relaxed);
+    }
+
+    struct Metric {
+        string name;
+        string help;
+        Labels labels;
+        // exactly one is set
+        unique_ptr<Counter> counter;
+        unique_ptr<Gauge> gauge;
+    };
+
+    // Registration is rare, so the registry takes a lock; it is never
+    // destroyed, so that metrics outlive any thread still counting at exit
+    struct Registry {
+        mutex access;
+        vector<Metric> metrics;
+    };
+
+    Registry& GetRegistry() {
+        static Registry& registry = *new Registry;
+        return registry;
+    }
+
+    Metric& FindOrAddMetric(vector<Metric>& metrics, string_view name, string_view help, Labels labels) {
+        const auto it = find_if(begin(metrics), end(metrics), [&](const Metric& metric) {
+            return metric.name == name && metric.labels == labels;
+        });
+        if (it != end(metrics)) {
+            return *it;
+        }
+        return metrics.emplace_back(Metric{
+            .name = string(name),
+            .help = string(help),
+            .labels = move(labels),
+            .counter = nullptr,
+            .gauge = nullptr,
+        });
+    }
+
+    Counter& GetCounter(string_view name, string_view help, Labels labels) {
+        auto& [access, metrics] = GetRegistry();
+        lock_guard lock(access);
+        Metric& metric = FindOrAddMetric(metrics, name, help, move(labels));
+        if (!metric.counter) {
+            metric.counter = make_unique<Counter>();
+        }
+        return *metric.counter;
+    }
+
+    Gauge& GetGauge(string_view name, string_view help, Labels labels) {
+        auto& [access, metrics] = GetRegistry();
+        lock_guard lock(access);
+        Metric& metric = FindOrAddMetric(metrics, name, help, move(labels));
+        if (!metric.gauge) {
+            metric.gauge = make_unique<Gauge>();
+        }
+        return *metric.gauge;
+    }
+
+    vector<Sample> Collect() {
+        auto& [access, metrics] = GetRegistry();
+        lock_guard lock(access);
+        vector<Sample> samples;
+        samples.reserve(metrics.size());
+        for (const Metric& metric : metrics) {
+            samples.push_back({
+                .name = metric.name,
+                .labels = metric.labels,
+                .value = metric.counter
+                    ? variant<uint64_t, double>(metric.counter->Get())
+                    : variant<uint64_t, double>(metric.gauge->Get()),
+            });
+        }
+        return samples;
+    }
+
+    double GetUptime() {
+        return chrono::duration<double>(chrono::steady_clock::now() - START_TIME).count();
+    }
+
+    void PrintLabels(ostream& output, const Labels& labels) {
+        if (labels.empty()) {
+            return;
+        }
+        output << '{';
+        bool first = true;
+        for (const auto& [key, value] : labels) {
+            if (!first) {
+                output << ',';
+            }
+            first = false;
+            output << key << "=\"";
+            for (const char c : value) {
+                if (c == '\n') {
+                    output << "\\n";
+                    continue;
+                }
+                if (c == '\\' || c == '"') {
+                    output << '\\';
+                }
+                output << c;
+            }
+            output << '"';
+        }
+        output << '}';
+    }
+
+    void PrintPrometheus(ostream& output) {
+        auto& [access, metrics] = GetRegistry();
+        lock_guard lock(access);
+        // samples of a name go together, after its HELP and TYPE lines
+        vector<bool> printed(metrics.size());
+        for (size_t i = 0; i < metrics.size(); ++i) {
+            if (printed[i]) {
+                continue;
+            }
+            const Metric& head = metrics[i];
+            output << "# HELP " << head.name << ' ' << head.help << '\n';
+            output << "# TYPE " << head.name << ' ' << (head.counter ? "counter" : "gauge") << '\n';
+            for (size_t j = i; j < metrics.size(); ++j) {
+                const Metric& metric = metrics[j];
+                if (metric.name != head.name) {
+                    continue;
+                }
+                printed[j] = true;
+                output << metric.name;
+                PrintLabels(output, metric.labels);
+                output << ' ';
+                if (metric.counter) {
+                    output << metric.counter->Get();
+                } else {
+                    output << metric.gauge->Get();
+                }
+                output << '\n';
+            }
+        }
+    }
+
+    void WritePrometheus(const string& path) {
+        const string temporary_path = path + ".tmp";
+        {
+            ofstream output(temporary_path);
+            PrintPrometheus(output);
+            if (!output) {
+                cerr << "cannot write metrics to " << temporary_path << endl;
+                return;
+            }
+        }
+        if (rename(temporary_path.c_str(), path.c_str()) != 0) {
+            cerr << "cannot replace " << path << endl;
+        }
+    }
+
+    void StartPrometheusDump(string path, chrono::seconds period) {
+        thread([path = move(path), period] {
+            for (;;) {
+                WritePrometheus(path);
+                this_thread::sleep_for(period);
+            }
+        }).detach();
+    }
+}
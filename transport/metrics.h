@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Live counters for the running process, always on and cheap enough for the
+// request path. A metric is registered once by name and labels, usually into
+// a function-local static reference, and lives until the process exits.
+namespace Metrics {
+
+    using Labels = std::vector<std::pair<std::string, std::string>>;
+
+    // Monotonic count, split into cache-line shards picked per thread, so
+    // threads that count at once do not fight over one line
+    class Counter {
+    public:
+        void Add(uint64_t value = 1);
+        uint64_t Get() const;
+
+    private:
+        static constexpr size_t SHARD_COUNT = 16;
+
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> value = 0;
+        };
+        std::array<Shard, SHARD_COUNT> shards_;
+    };
+
+    // Last value set
+    class Gauge {
+    public:
+        void Set(double value);
+        double Get() const;
+
+    private:
+        std::atomic<double> value_ = 0;
+    };
+
+    // The same name and labels give the same metric; help is kept from the
+    // first registration of a name
+    Counter& GetCounter(std::string_view name, std::string_view help, Labels labels = {});
+    Gauge& GetGauge(std::string_view name, std::string_view help, Labels labels = {});
+
+    struct Sample {
+        std::string name;
+        Labels labels;
+        std::variant<uint64_t, double> value;  // of a counter or a gauge
+    };
+
+    // Every metric in order of registration
+    std::vector<Sample> Collect();
+    // Seconds since the program started
+    double GetUptime();
+
+    // Prometheus text exposition format
+    void PrintPrometheus(std::ostream& output);
+
+    // Rewrites the file at path with PrintPrometheus every period from a
+    // detached thread; the file is replaced by a rename, so readers never
+    // see it half-written
+    void StartPrometheusDump(std::string path, std::chrono::seconds period);
+    void WritePrometheus(const std::string& path);
+}
@@ -0,0 +1,190 @@
+#include "network.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+
+using namespace std;
+
+namespace Network {
+
+    template <typename Item>
+    vector<const Item*> CollectSortedByName(const vector<Descriptions::InputQuery>& data) {
+        vector<const Item*> items;
+        for (const auto& query : data) {
+            if (const auto* item = get_if<Item>(&query)) {
+                items.push_back(item);
+            }
+        }
+        sort(begin(items), end(items), [](const Item* lhs, const Item* rhs) {
+            return lhs->name < rhs->name;
+        });
+        return items;
+    }
+
+    optional<uint32_t> FindId(const unordered_map<string_view, uint32_t>& ids, string_view name) {
+        if (auto it = ids.find(name); it != ids.end()) {
+            return it->second;
+        } else {
+            return nullopt;
+        }
+    }
+
+    Model::Model(const vector<Descriptions::InputQuery>& data) {
+        LOG_DURATION("build network");
+        const auto stop_descriptions = CollectSortedByName<Descriptions::Stop>(data);
+        stops_.reserve(stop_descriptions.size());
+        stop_ids_.reserve(stop_descriptions.size());
+        for (const auto* stop : stop_descriptions) {
+            const string_view name = names_.Intern(stop->name);
+            stop_ids_.emplace(name, stops_.size());
+            stops_.push_back({name, stop->position, Sphere::PreparedPoint::FromDegrees(stop->position)});
+        }
+
+        BuildDistances(stop_descriptions);
+        router_order_ = ComputeRouterOrder(data);
+
+        const auto bus_descriptions = CollectSortedByName<Descriptions::Bus>(data);
+        buses_.reserve(bus_descriptions.size());
+        bus_ids_.reserve(bus_descriptions.size());
+        auto to_stop_ids = [this](const vector<string>& stop_names) {
+            vector<StopId> ids;
+            ids.reserve(stop_names.size());
+            for (const string& stop_name : stop_names) {
+                ids.push_back(FindStop(stop_name).value());
+            }
+            return ids;
+        };
+        for (const auto* bus : bus_descriptions) {
+            const string_view name = names_.Intern(bus->name);
+            bus_ids_.emplace(name, buses_.size());
+            auto stops = to_stop_ids(bus->stops);
+            auto cumulative_distances = ComputeCumulativeDistances(stops);
+            buses_.push_back({name, move(stops), to_stop_ids(bus->endpoints), move(cumulative_distances)});
+        }
+    }
+
+    optional<StopId> Model::FindStop(string_view name) const {
+        return FindId(stop_ids_, name);
+    }
+
+    optional<BusId> Model::FindBus(string_view name) const {
+        return FindId(bus_ids_, name);
+    }
+
+    vector<StopId> Model::ComputeRouterOrder(const vector<Descriptions::InputQuery>& data) const {
+        // the stops as std::partition left them in the input, then put
+        // into a hash map one by one
+        vector<const Descriptions::InputQuery*> queries;
+        queries.reserve(data.size());
+        for (const auto& query : data) {
+            queries.push_back(&query);
+        }
+        const auto stops_end = partition(begin(queries), end(queries), [](const Descriptions::InputQuery* query) {
+            return holds_alternative<Descriptions::Stop>(*query);
+        });
+        unordered_map<string_view, StopId> ids_by_name;
+        for (auto it = begin(queries); it != stops_end; ++it) {
+            const string_view name = get<Descriptions::Stop>(**it).name;
+            ids_by_name[name] = FindStop(name).value();
+        }
+
+        vector<StopId> order;
+        order.reserve(stops_.size());
+        vector<bool> is_ordered(stops_.size());
+        for (const auto& [name, id] : ids_by_name) {
+            order.push_back(id);
+            is_ordered[id] = true;
+        }
+        // a repeated name took a single slot in the map
+        for (StopId id = 0; id < stops_.size(); ++id) {
+            if (!is_ordered[id]) {
+                order.push_back(id);
+            }
+        }
+        return order;
+    }
+
+    void Model::BuildDistances(const vector<const Descriptions::Stop*>& stop_descriptions) {
+        struct Entry {
+            StopId from;
+            StopId to;
+            int distance;
+            bool is_explicit;
+        };
+        vector<Entry> entries;
+        for (StopId id = 0; id < stops_.size(); ++id) {
+            for (const auto& [neighbour_name, distance] : stop_descriptions[id]->distances) {
+                // a road to a stop never described cannot be travelled
+                const auto neighbour_id = FindStop(neighbour_name);
+                if (!neighbour_id) {
+                    continue;
+                }
+                entries.push_back({id, *neighbour_id, distance, true});
+                entries.push_back({*neighbour_id, id, distance, false});
+            }
+        }
+        // an explicitly given direction wins over the mirrored one
+        sort(begin(entries), end(entries), [](const Entry& lhs, const Entry& rhs) {
+            return tie(lhs.from, lhs.to, rhs.is_explicit) < tie(rhs.from, rhs.to, lhs.is_explicit);
+        });
+        entries.erase(
+            unique(begin(entries), end(entries), [](const Entry& lhs, const Entry& rhs) {
+                return lhs.from == rhs.from && lhs.to == rhs.to;
+            }),
+            end(entries)
+        );
+
+        distance_offsets_.assign(stops_.size() + 1, 0);
+        distances_.reserve(entries.size());
+        for (const Entry& entry : entries) {
+            ++distance_offsets_[entry.from + 1];
+            distances_.push_back({entry.to, entry.distance});
+        }
+        partial_sum(begin(distance_offsets_), end(distance_offsets_), begin(distance_offsets_));
+    }
+
+    vector<int> Model::ComputeCumulativeDistances(const vector<StopId>& stops) const {
+        vector<int> cumulative_distances;
+        cumulative_distances.reserve(stops.size());
+        int total_distance = 0;
+        for (size_t i = 0; i < stops.size(); ++i) {
+            if (i > 0) {
+                total_distance += GetRoadDistance(stops[i - 1], stops[i]);
+            }
+            cumulative_distances.push_back(total_distance);
+        }
+        return cumulative_distances;
+    }
+
+    int Model::GetRoadDistance(StopId from, StopId to) const {
+        const auto row_begin = begin(distances_) + distance_offsets_[from];
+        const auto row_end = begin(distances_) + distance_offsets_[from + 1];
+        const auto it = lower_bound(row_begin, row_end, to, [](const RoadDistance& item, StopId to) {
+            return item.to < to;
+        });
+        if (it == row_end || it->to != to) {
+            throw out_of_range("no road distance between stops");
+        }
+        return it->distance;
+    }
+
+    Memory::Usage Model::GetMemoryUsage() const {
+        Memory::Usage usage = names_.GetMemoryUsage()
+            + Memory::GetVectorUsage(stops_)
+            + Memory::GetVectorUsage(buses_)
+            + Memory::GetHashTableUsage(stop_ids_)
+            + Memory::GetHashTableUsage(bus_ids_)
+            + Memory::GetVectorUsage(router_order_)
+            + Memory::GetVectorUsage(distance_offsets_)
+            + Memory::GetVectorUsage(distances_);
+        for (const Bus& bus : buses_) {
+            usage += Memory::GetVectorUsage(bus.stops)
+                + Memory::GetVectorUsage(bus.endpoints)
+                + Memory::GetVectorUsage(bus.cumulative_distances);
+        }
+        return usage;
+    }
+}
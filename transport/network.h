@@ -0,0 +1,87 @@
+#pragma once
+
+#include "descriptions.h"
+#include "memory_usage.h"
+#include "sphere.h"
+#include "string_pool.h"
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The transport network the catalog is built from: every stop and bus gets
+// a dense id once at load time, and all per-stop and per-bus data lives in
+// arrays indexed by those ids.
+namespace Network {
+
+    using StopId = uint32_t;
+    using BusId = uint32_t;
+
+    struct Stop {
+        std::string_view name;
+        Sphere::Point position;
+        Sphere::PreparedPoint prepared_position;
+    };
+
+    struct Bus {
+        std::string_view name;
+        std::vector<StopId> stops;
+        std::vector<StopId> endpoints;
+        // Road distance from the first stop to every stop of the route, so the
+        // length of any segment is a difference of two items
+        std::vector<int> cumulative_distances;
+    };
+
+    class Model {
+    public:
+        Model() = default;
+        explicit Model(const std::vector<Descriptions::InputQuery>& data);
+
+        // Ids follow name order, so passes in id order visit items in the
+        // same order as the name-keyed maps used to
+        const std::vector<Stop>& GetStops() const { return stops_; }
+        const std::vector<Bus>& GetBuses() const { return buses_; }
+        const Stop& GetStop(StopId id) const { return stops_[id]; }
+        const Bus& GetBus(BusId id) const { return buses_[id]; }
+        // Every stop once, in the order the router numbers its vertices:
+        // that of the name-keyed hash map it was first built from. Among
+        // routes of equal time the router picks by vertex order, so this
+        // keeps its choices unchanged.
+        const std::vector<StopId>& GetRouterOrder() const { return router_order_; }
+
+        std::optional<StopId> FindStop(std::string_view name) const;
+        std::optional<BusId> FindBus(std::string_view name) const;
+
+        // Throws std::out_of_range if neither direction was given
+        int GetRoadDistance(StopId from, StopId to) const;
+
+        Memory::Usage GetMemoryUsage() const;
+
+    private:
+        using NameIndex = std::unordered_map<std::string_view, uint32_t>;
+
+        void BuildDistances(const std::vector<const Descriptions::Stop*>& stop_descriptions);
+        std::vector<StopId> ComputeRouterOrder(const std::vector<Descriptions::InputQuery>& data) const;
+        std::vector<int> ComputeCumulativeDistances(const std::vector<StopId>& stops) const;
+
+        // Every name below is a view into names_, so it is declared first
+        StringPool names_;
+        std::vector<Stop> stops_;
+        std::vector<Bus> buses_;
+        NameIndex stop_ids_;
+        NameIndex bus_ids_;
+        std::vector<StopId> router_order_;
+
+        // Road distances in CSR form: the row of stop s is
+        // [distance_offsets_[s], distance_offsets_[s + 1]), sorted by target.
+        // The reverse direction is filled in wherever it was not given.
+        struct RoadDistance {
+            StopId to;
+            int distance;
+        };
+        std::vector<uint32_t> distance_offsets_;
+        std::vector<RoadDistance> distances_;
+    };
+}
@@ -0,0 +1,263 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace Profile {
+
+    atomic<bool>& GetEnabledFlag() {
+        static atomic<bool> enabled = [] {
+            const char* value = getenv("TRANSPORT_PROFILE");
+            return value && *value && string_view(value) != "0";
+        }();
+        return enabled;
+    }
+
+    void Enable() {
+        GetEnabledFlag().store(true, memory_order_relaxed);
+    }
+
+    bool IsEnabled() {
+        return GetEnabledFlag().load(memory_order_relaxed);
+    }
+
+    struct Phase {
+        string_view name;
+        Clock::duration total{};
+        size_t count = 0;
+    };
+
+    // Phases end a handful of times per catalog, so a lock is cheap enough
+    struct Phases {
+        mutex access;
+        vector<Phase> phases;
+    };
+
+    Phases& GetPhases() {
+        static Phases phases;
+        return phases;
+    }
+
+    void AddPhaseTime(string_view name, Clock::duration duration) {
+        auto& [access, phases] = GetPhases();
+        lock_guard lock(access);
+        auto it = find_if(begin(phases), end(phases), [name](const Phase& phase) { return phase.name == name; });
+        if (it == end(phases)) {
+            it = phases.insert(end(phases), Phase{.name = name});
+        }
+        it->total += duration;
+        ++it->count;
+    }
+
+    ScopedTimer::ScopedTimer(string_view phase)
+        : phase_(phase),
+          enabled_(IsEnabled())
+    {
+        if (enabled_) {
+            start_ = Clock::now();
+        }
+    }
+
+    ScopedTimer::~ScopedTimer() {
+        if (enabled_) {
+            AddPhaseTime(phase_, Clock::now() - start_);
+        }
+    }
+
+    size_t LatencyHistogram::GetBucket(uint64_t nanoseconds) {
+        if (nanoseconds < SUB_BUCKET_COUNT) {
+            return nanoseconds;
+        }
+        // the leading SUB_BUCKET_BITS + 1 bits select the bucket
+        const size_t shift = bit_width(nanoseconds) - SUB_BUCKET_BITS - 1;
+        const size_t bucket = (shift + 1) * SUB_BUCKET_COUNT + ((nanoseconds >> shift) - SUB_BUCKET_COUNT);
+        return min(bucket, BUCKET_COUNT - 1);
+    }
+
+    uint64_t LatencyHistogram::GetBucketValue(size_t bucket) {
+        if (bucket < SUB_BUCKET_COUNT) {
+            return bucket;
+        }
+        const size_t shift = bucket / SUB_BUCKET_COUNT - 1;
+        const uint64_t lower = (SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+        return lower + (uint64_t{1} << shift) / 2;
+    }
+
+    uint64_t LatencyHistogram::GetQuantile(const Counts& counts, uint64_t count, double quantile) {
+        const uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(ceil(quantile * count)));
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < counts.size(); ++bucket) {
+            seen += counts[bucket];
+            if (seen >= rank) {
+                return GetBucketValue(bucket);
+            }
+        }
+        return 0;
+    }
+
+    void LatencyHistogram::Record(Clock::duration latency) {
+        const auto nanoseconds = chrono::duration_cast<chrono::nanoseconds>(latency).count();
+        auto& bucket = buckets_[GetBucket(max<int64_t>(nanoseconds, 0))];
+        // the owner is the only writer, so no read-modify-write is needed
+        bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+
+    void LatencyHistogram::AddTo(Counts& counts) const {
+        for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+            counts[bucket] += buckets_[bucket].load(memory_order_relaxed);
+        }
+    }
+
+    struct ThreadLatencies {
+        array<LatencyHistogram, MAX_LATENCY_KINDS> histograms;
+    };
+
+    // Kind names, and the histograms of every thread that ever recorded; a
+    // thread takes the lock once, when it records for the first time, and
+    // its histograms outlive it so that its counts still make the report
+    struct Latencies {
+        mutex access;
+        vector<string_view> kind_names;
+        vector<unique_ptr<ThreadLatencies>> threads;
+    };
+
+    Latencies& GetLatencies() {
+        static Latencies latencies;
+        return latencies;
+    }
+
+    LatencyKind RegisterLatencyKind(string_view name) {
+        auto& [access, kind_names, threads] = GetLatencies();
+        lock_guard lock(access);
+        const auto it = find(begin(kind_names), end(kind_names), name);
+        if (it != end(kind_names)) {
+            return static_cast<LatencyKind>(it - begin(kind_names));
+        }
+        if (kind_names.size() == MAX_LATENCY_KINDS) {
+            throw length_error("too many latency kinds");
+        }
+        kind_names.push_back(name);
+        return static_cast<LatencyKind>(kind_names.size() - 1);
+    }
+
+    ThreadLatencies& GetThreadLatencies() {
+        thread_local ThreadLatencies* thread_latencies = [] {
+            auto& [access, kind_names, threads] = GetLatencies();
+            lock_guard lock(access);
+            return threads.emplace_back(make_unique<ThreadLatencies>()).get();
+        }();
+        return *thread_latencies;
+    }
+
+    void RecordLatency(LatencyKind kind, Clock::duration latency) {
+        GetThreadLatencies().histograms[kind].Record(latency);
+    }
+
+    double ToMilliseconds(Clock::duration duration) {
+        return chrono::duration<double, milli>(duration).count();
+    }
+
+    double ToMicroseconds(uint64_t nanoseconds) {
+        return nanoseconds / 1000.0;
+    }
+
+    void PrintPhases(ostream& output) {
+        auto& [access, phases] = GetPhases();
+        lock_guard lock(access);
+        if (phases.empty()) {
+            return;
+        }
+        output << left << setw(28) << "phase" << right << setw(12) << "total ms" << setw(8) << "count" << '\n';
+        for (const auto& phase : phases) {
+            output << left << setw(28) << phase.name << right
+                   << setw(12) << ToMilliseconds(phase.total)
+                   << setw(8) << phase.count << '\n';
+        }
+    }
+
+    void PrintLatencies(ostream& output) {
+        auto& [access, kind_names, threads] = GetLatencies();
+        lock_guard lock(access);
+        bool header_printed = false;
+        for (size_t kind = 0; kind < kind_names.size(); ++kind) {
+            LatencyHistogram::Counts counts{};
+            for (const auto& thread_latencies : threads) {
+                thread_latencies->histograms[kind].AddTo(counts);
+            }
+            uint64_t count = 0;
+            for (const uint64_t bucket_count : counts) {
+                count += bucket_count;
+            }
+            if (count == 0) {
+                continue;
+            }
+
+            if (!header_printed) {
+                output << left << setw(12) << "request" << right << setw(10) << "count";
+                for (const string_view column : {"p50 us", "p99 us", "p999 us", "max us"}) {
+                    output << setw(12) << column;
+                }
+                output << '\n';
+                header_printed = true;
+            }
+            output << left << setw(12) << kind_names[kind] << right << setw(10) << count;
+            for (const double quantile : {0.5, 0.99, 0.999, 1.0}) {
+                output << setw(12) << ToMicroseconds(LatencyHistogram::GetQuantile(counts, count, quantile));
+            }
+            output << '\n';
+        }
+    }
+
+    size_t Trace::Open(string_view name) {
+        const optional<size_t> parent = open_spans_.empty() ? nullopt : optional(open_spans_.back());
+        spans_.push_back({.name = name, .parent = parent, .duration = {}, .counts = {}});
+        open_spans_.push_back(spans_.size() - 1);
+        return spans_.size() - 1;
+    }
+
+    void Trace::Close(size_t span, Clock::duration duration) {
+        spans_[span].duration = duration;
+        // spans close in reverse order of opening, as scopes end
+        if (!open_spans_.empty() && open_spans_.back() == span) {
+            open_spans_.pop_back();
+        }
+    }
+
+    void Trace::Count(string_view name, uint64_t value) {
+        if (spans_.empty()) {
+            return;
+        }
+        auto& counts = spans_[open_spans_.empty() ? spans_.size() - 1 : open_spans_.back()].counts;
+        const auto it = find_if(begin(counts), end(counts), [name](const auto& count) { return count.first == name; });
+        if (it == end(counts)) {
+            counts.emplace_back(name, value);
+        } else {
+            it->second += value;
+        }
+    }
+
+    const vector<Trace::Span>& Trace::GetSpans() const {
+        return spans_;
+    }
+
+    void PrintReport(ostream& output) {
+        const auto flags = output.flags();
+        const auto precision = output.precision();
+        output << fixed << setprecision(3);
+        PrintPhases(output);
+        PrintLatencies(output);
+        output.flags(flags);
+        output.precision(precision);
+        output.flush();
+    }
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Timing instrumentation, off unless turned on by Profile::Enable or by a
+// nonempty TRANSPORT_PROFILE environment variable other than "0". While off,
+// a timer costs one relaxed load and records nothing.
+namespace Profile {
+    using Clock = std::chrono::steady_clock;
+
+    void Enable();
+    bool IsEnabled();
+
+    // Adds the time from construction to destruction to phase, which must
+    // outlive the report: meant for string literals
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(std::string_view phase);
+        ~ScopedTimer();
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        std::string_view phase_;
+        bool enabled_;
+        Clock::time_point start_;
+    };
+
+    // Log-linear histogram of nanoseconds: 16 buckets per power of two, so
+    // a quantile is off by at most 1/16 of its value. Only the owning thread
+    // records, any thread may read at any time.
+    class LatencyHistogram {
+    public:
+        static constexpr size_t SUB_BUCKET_BITS = 4;
+        static constexpr size_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+        // powers of two up to about 18 minutes, longer ones share the last bucket
+        static constexpr size_t BUCKET_COUNT = 38 * SUB_BUCKET_COUNT;
+
+        using Counts = std::array<uint64_t, BUCKET_COUNT>;
+
+        void Record(Clock::duration latency);
+        void AddTo(Counts& counts) const;
+
+        static size_t GetBucket(uint64_t nanoseconds);
+        // The middle of the bucket
+        static uint64_t GetBucketValue(size_t bucket);
+        // The value below which at least quantile of the count recorded values lie
+        static uint64_t GetQuantile(const Counts& counts, uint64_t count, double quantile);
+
+    private:
+        std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_{};
+    };
+
+    // Kinds are few and registered once, e.g. one per request type
+    using LatencyKind = uint8_t;
+    static constexpr size_t MAX_LATENCY_KINDS = 16;
+    LatencyKind RegisterLatencyKind(std::string_view name);
+
+    // Goes to a histogram of the calling thread; the histograms of all
+    // threads are only summed up by the report
+    void RecordLatency(LatencyKind kind, Clock::duration latency);
+
+    // Phase totals in order of first use, then latency quantiles per kind
+    void PrintReport(std::ostream& output);
+
+    // Breakdown of a single request, collected only for requests that ask
+    // for one, independently of Enable. Spans nest as the scopes that open
+    // them do and carry counts of the work done inside.
+    class Trace {
+    public:
+        struct Span {
+            std::string_view name;
+            std::optional<size_t> parent;  // index in GetSpans
+            Clock::duration duration{};
+            std::vector<std::pair<std::string_view, uint64_t>> counts;
+        };
+
+        size_t Open(std::string_view name);
+        void Close(size_t span, Clock::duration duration);
+        // Adds to the count of the innermost open span, or of the last one
+        void Count(std::string_view name, uint64_t value);
+
+        // In order of opening, so a parent comes before its children
+        const std::vector<Span>& GetSpans() const;
+
+    private:
+        std::vector<Span> spans_;
+        std::vector<size_t> open_spans_;
+    };
+
+    // The trace of the request the calling thread is answering, if any
+    inline thread_local Trace* active_trace = nullptr;
+
+    // Makes trace the calling thread's active one for the scope
+    class ActiveTrace {
+    public:
+        explicit ActiveTrace(Trace& trace) : previous_(active_trace) { active_trace = &trace; }
+        ~ActiveTrace() { active_trace = previous_; }
+
+        ActiveTrace(const ActiveTrace&) = delete;
+        ActiveTrace& operator=(const ActiveTrace&) = delete;
+
+    private:
+        Trace* previous_;
+    };
+
+    // A span of the active trace for the scope; without one it only reads
+    // a thread-local pointer
+    class TraceSpan {
+    public:
+        explicit TraceSpan(std::string_view name) : trace_(active_trace) {
+            if (trace_) {
+                span_ = trace_->Open(name);
+                start_ = Clock::now();
+            }
+        }
+        ~TraceSpan() {
+            if (trace_) {
+                trace_->Close(span_, Clock::now() - start_);
+            }
+        }
+
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+
+    private:
+        Trace* trace_;
+        size_t span_ = 0;
+        Clock::time_point start_;
+    };
+
+    inline void TraceCount(std::string_view name, uint64_t value) {
+        if (active_trace) {
+            active_trace->Count(name, value);
+        }
+    }
+}
+
+#define PROFILE_CONCAT_IMPL(lhs, rhs) lhs##rhs
+#define PROFILE_CONCAT(lhs, rhs) PROFILE_CONCAT_IMPL(lhs, rhs)
+#define LOG_DURATION(phase) Profile::ScopedTimer PROFILE_CONCAT(profile_timer_, __LINE__)(phase)
+#define TRACE_SPAN(name) Profile::TraceSpan PROFILE_CONCAT(trace_span_, __LINE__)(name)
@@ -0,0 +1,293 @@
+// Replays a recorded stream of stat requests against a catalog built once,
+// through the same Server::ProcessLine path as the resident mode, and
+// reports throughput and latency quantiles per request type. Built from
+// the sources in this directory and every source of the transport binary
+// but its main.cpp, with the transport directory on the include path.
+//
+//   replay --catalog FILE [--requests FILE] [--concurrency N] [--rate R]
+//          [--repeat N] [--perf] [--profile] [--prebuilt-responses]
+//          [--route-cache-mb N]
+//
+// The catalog file is the usual input document; its stat_requests are
+// replayed unless --requests gives a file of request lines as --serve reads
+// them. By default the loop is closed: N workers each send the next request
+// as soon as the previous one is answered. With --rate the loop is open:
+// requests are due at R per second whether or not the N workers keep up,
+// and latency counts from the time a request was due, so a backlog shows.
+// --perf adds hardware counters of the workers.
+
+#include "perf_counters.h"
+
+#include "descriptions.h"
+#include "json.h"
+#include "profile.h"
+#include "server.h"
+#include "transport_catalog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct Options {
+    string catalog_path;
+    optional<string> requests_path;
+    TransportCatalog::Options catalog;
+    size_t concurrency = 1;
+    // requests per second, for an open loop
+    optional<double> rate;
+    size_t repeat = 1;
+    bool perf = false;
+};
+
+Options ParseOptions(const vector<string_view>& args) {
+    Options options;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string_view arg = args[i];
+        if (arg == "--perf") {
+            options.perf = true;
+            continue;
+        } else if (arg == "--profile") {
+            Profile::Enable();
+            continue;
+        } else if (arg == "--prebuilt-responses") {
+            options.catalog.prebuilt_responses = true;
+            continue;
+        }
+        if (i + 1 == args.size()) {
+            throw invalid_argument("missing value for " + string(arg));
+        }
+        const string value(args[++i]);
+        if (arg == "--catalog") {
+            options.catalog_path = value;
+        } else if (arg == "--requests") {
+            options.requests_path = value;
+        } else if (arg == "--concurrency") {
+            options.concurrency = max<size_t>(stoul(value), 1);
+        } else if (arg == "--rate") {
+            options.rate = stod(value);
+        } else if (arg == "--route-cache-mb") {
+            options.catalog.route_cache_bytes = stoul(value) << 20;
+        } else if (arg == "--repeat") {
+            options.repeat = stoul(value);
+        } else {
+            throw invalid_argument("unknown option " + string(arg));
+        }
+    }
+    if (options.catalog_path.empty()) {
+        throw invalid_argument("--catalog is required");
+    }
+    if (options.rate && *options.rate <= 0) {
+        throw invalid_argument("--rate must be positive");
+    }
+    return options;
+}
+
+ifstream OpenFile(const string& path) {
+    ifstream input(path);
+    if (!input) {
+        throw runtime_error("cannot open " + path);
+    }
+    return input;
+}
+
+struct RecordedRequest {
+    string line;
+    size_t type;  // index in Stream::type_names
+};
+
+struct Stream {
+    vector<string> type_names;
+    vector<RecordedRequest> requests;
+
+    void Add(string line) {
+        string type_name = "invalid";
+        try {
+            istringstream input(line);
+            type_name = Json::Load(input).GetRoot().AsMap().at("type").AsString();
+        } catch (const exception&) {
+            // still replayed, and answered with an error as the server would
+        }
+        const auto it = find(begin(type_names), end(type_names), type_name);
+        const size_t type = it - begin(type_names);
+        if (it == end(type_names)) {
+            type_names.push_back(move(type_name));
+        }
+        requests.push_back({.line = move(line), .type = type});
+    }
+};
+
+Stream ReadStream(const Json::Dict& input_map, const Options& options) {
+    Stream stream;
+    if (options.requests_path) {
+        ifstream input = OpenFile(*options.requests_path);
+        for (string line; getline(input, line);) {
+            if (line.find_first_not_of(" \t\r") != string::npos) {
+                stream.Add(move(line));
+            }
+        }
+    } else {
+        for (const Json::Node& request : input_map.at("stat_requests").AsArray()) {
+            ostringstream line;
+            Json::PrintNode(request, line);
+            stream.Add(line.str());
+        }
+    }
+    if (stream.requests.empty()) {
+        throw invalid_argument("no requests to replay");
+    }
+    return stream;
+}
+
+using Clock = Profile::Clock;
+
+struct WorkerResult {
+    vector<Profile::LatencyHistogram> latencies;  // by request type
+    size_t response_bytes = 0;
+    optional<PerfCounters::Values> counters;
+    string counters_error;
+
+    explicit WorkerResult(size_t type_count) : latencies(type_count) {}
+};
+
+static constexpr auto SPIN_TIME = chrono::microseconds(200);
+
+void RunWorker(const TransportCatalog& db, const Stream& stream, const Options& options,
+               Clock::time_point start, size_t total, atomic<size_t>& next, WorkerResult& result) {
+    optional<PerfCounters> counters;
+    if (options.perf) {
+        counters.emplace();
+        counters->Start();
+    }
+
+    for (size_t index; (index = next.fetch_add(1, memory_order_relaxed)) < total;) {
+        const RecordedRequest& request = stream.requests[index % stream.requests.size()];
+        auto request_start = Clock::now();
+        if (options.rate) {
+            request_start = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(index / *options.rate));
+            // sleeping overshoots by tens of microseconds, spinning does not
+            this_thread::sleep_until(request_start - SPIN_TIME);
+            while (Clock::now() < request_start) {
+            }
+        }
+        result.response_bytes += Server::ProcessLine(db, request.line).size();
+        result.latencies[request.type].Record(Clock::now() - request_start);
+    }
+
+    if (counters) {
+        counters->Stop();
+        if (counters->IsAvailable()) {
+            result.counters = counters->Read();
+        } else {
+            result.counters_error = counters->GetError();
+        }
+    }
+}
+
+void PrintLatencyRow(string_view name, const Profile::LatencyHistogram::Counts& counts, ostream& output) {
+    uint64_t count = 0;
+    for (const uint64_t bucket_count : counts) {
+        count += bucket_count;
+    }
+    output << left << setw(12) << name << right << setw(10) << count;
+    for (const double quantile : {0.5, 0.99, 0.999, 1.0}) {
+        output << setw(12) << Profile::LatencyHistogram::GetQuantile(counts, count, quantile) / 1000.0;
+    }
+    output << '\n';
+}
+
+void PrintReport(const Stream& stream, const Options& options, size_t total,
+                 Clock::duration elapsed, const vector<WorkerResult>& results, ostream& output) {
+    const double seconds = chrono::duration<double>(elapsed).count();
+    output << fixed << setprecision(3)
+           << "replayed " << total << " requests with " << options.concurrency << " workers, ";
+    if (options.rate) {
+        output << "open loop at " << *options.rate << " per second";
+    } else {
+        output << "closed loop";
+    }
+    output << ", in " << seconds << " s: " << total / seconds << " per second\n";
+
+    output << left << setw(12) << "request" << right << setw(10) << "count";
+    for (const string_view column : {"p50 us", "p99 us", "p999 us", "max us"}) {
+        output << setw(12) << column;
+    }
+    output << '\n';
+    Profile::LatencyHistogram::Counts all_counts{};
+    for (size_t type = 0; type < stream.type_names.size(); ++type) {
+        Profile::LatencyHistogram::Counts counts{};
+        for (const auto& result : results) {
+            result.latencies[type].AddTo(counts);
+            result.latencies[type].AddTo(all_counts);
+        }
+        PrintLatencyRow(stream.type_names[type], counts, output);
+    }
+    PrintLatencyRow("all", all_counts, output);
+
+    if (!options.perf) {
+        return;
+    }
+    PerfCounters::Values totals{};
+    for (const auto& result : results) {
+        if (!result.counters) {
+            output << "hardware counters unavailable: " << result.counters_error << '\n';
+            return;
+        }
+        for (size_t counter = 0; counter < PerfCounters::COUNTER_COUNT; ++counter) {
+            totals[counter] += (*result.counters)[counter];
+        }
+    }
+    for (size_t counter = 0; counter < PerfCounters::COUNTER_COUNT; ++counter) {
+        output << left << setw(28) << string(PerfCounters::NAMES[counter]) + " per request"
+               << right << setw(14) << static_cast<double>(totals[counter]) / total << '\n';
+    }
+    output << left << setw(28) << "instructions per cycle" << right << setw(14)
+           << (totals[0] > 0 ? static_cast<double>(totals[1]) / totals[0] : 0.0) << '\n';
+}
+
+int main(int argc, const char* argv[]) {
+    const Options options = ParseOptions({argv + 1, argv + argc});
+    ifstream catalog_input = OpenFile(options.catalog_path);
+    const auto input_doc = Json::Load(catalog_input);
+    const auto& input_map = input_doc.GetRoot().AsMap();
+    const Stream stream = ReadStream(input_map, options);
+    const TransportCatalog db(
+        Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray()),
+        input_map.at("routing_settings").AsMap(),
+        input_map.at("render_settings").AsMap(),
+        options.catalog
+    );
+
+    const size_t total = stream.requests.size() * options.repeat;
+    vector<WorkerResult> results;
+    results.reserve(options.concurrency);
+    for (size_t worker = 0; worker < options.concurrency; ++worker) {
+        results.emplace_back(stream.type_names.size());
+    }
+    atomic<size_t> next = 0;
+    const auto start = Clock::now();
+    {
+        vector<jthread> workers;
+        for (auto& result : results) {
+            workers.emplace_back([&] { RunWorker(db, stream, options, start, total, next, result); });
+        }
+    }
+    const auto elapsed = Clock::now() - start;
+
+    PrintReport(stream, options, total, elapsed, results, cout);
+    if (Profile::IsEnabled()) {
+        Profile::PrintReport(cerr);
+    }
+    return 0;
+}
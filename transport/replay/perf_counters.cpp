@@ -0,0 +1,96 @@
+#include "perf_counters.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+static constexpr array<uint64_t, PerfCounters::COUNTER_COUNT> EVENTS = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+// One group led by the first counter, so that all of them count over
+// exactly the same instructions
+PerfCounters::PerfCounters() {
+    fds_.fill(-1);
+    for (size_t counter = 0; counter < COUNTER_COUNT; ++counter) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = EVENTS[counter];
+        attr.disabled = counter == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        const long fd = syscall(SYS_perf_event_open, &attr, 0, -1, fds_[0], 0);
+        if (fd < 0) {
+            error_ = string(NAMES[counter]) + ": " + strerror(errno);
+            break;
+        }
+        fds_[counter] = static_cast<int>(fd);
+    }
+    if (!error_.empty()) {
+        for (int& fd : fds_) {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (const int fd : fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool PerfCounters::IsAvailable() const {
+    return fds_[0] >= 0;
+}
+
+const string& PerfCounters::GetError() const {
+    return error_;
+}
+
+void PerfCounters::Start() {
+    if (IsAvailable()) {
+        ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+void PerfCounters::Stop() {
+    if (IsAvailable()) {
+        ioctl(fds_[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+PerfCounters::Values PerfCounters::Read() const {
+    Values values{};
+    if (!IsAvailable()) {
+        return values;
+    }
+    // counter count, time enabled, time running, then the values
+    array<uint64_t, 3 + COUNTER_COUNT> buffer{};
+    if (read(fds_[0], buffer.data(), sizeof(buffer)) < static_cast<ssize_t>(sizeof(buffer))) {
+        return values;
+    }
+    const uint64_t enabled = buffer[1];
+    const uint64_t running = buffer[2];
+    for (size_t counter = 0; counter < COUNTER_COUNT; ++counter) {
+        values[counter] = running > 0 && running < enabled
+            ? static_cast<uint64_t>(static_cast<double>(buffer[3 + counter]) * enabled / running)
+            : buffer[3 + counter];
+    }
+    return values;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Hardware counters of the calling thread through perf_event_open, user
+// space only. Kernels that forbid it, or machines without a PMU, leave the
+// counters unavailable rather than failing.
+class PerfCounters {
+public:
+    static constexpr size_t COUNTER_COUNT = 4;
+    static constexpr std::array<std::string_view, COUNTER_COUNT> NAMES = {
+        "cycles", "instructions", "cache_misses", "branch_misses",
+    };
+
+    using Values = std::array<uint64_t, COUNTER_COUNT>;
+
+    // Opens the counters disabled, for the thread that constructs them
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool IsAvailable() const;
+    // Why the counters could not be opened
+    const std::string& GetError() const;
+
+    void Start();
+    void Stop();
+    // Totals over the time between every Start and the following Stop,
+    // scaled up if the kernel multiplexed the counters
+    Values Read() const;
+
+private:
+    std::array<int, COUNTER_COUNT> fds_;
+    std::string error_;
+};
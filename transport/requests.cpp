@@ -1,7 +1,22 @@
 #include "requests.h"
+#include "deadline.h"
+#include "metrics.h"
 #include "transport_router.h"
 #include "profile.h"
 
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 using namespace std;
@@ -10,41 +25,25 @@ namespace Requests {
 
     Json::Dict Stop::Process(const TransportCatalog& db) const {
         const auto* stop = db.GetStop(name);
-        Json::Dict dict;
         if (!stop) {
-            dict["error_message"] = Json::Node("not found"s);
-        } else {
-            vector<Json::Node> bus_nodes;
-            bus_nodes.reserve(stop->bus_names.size());
-            for (const auto& bus_name : stop->bus_names) {
-                bus_nodes.emplace_back(bus_name);
-            }
-            dict["buses"] = Json::Node(move(bus_nodes));
+            return {{"error_message", Json::Node("not found"s)}};
         }
-        return dict;
+        return Responses::ToJson(*stop);
     }
 
     Json::Dict Bus::Process(const TransportCatalog& db) const {
         const auto* bus = db.GetBus(name);
-        Json::Dict dict;
         if (!bus) {
-            dict["error_message"] = Json::Node("not found"s);
-        } else {
-            dict = {
-                {"stop_count", Json::Node(static_cast<int>(bus->stop_count))},
-                {"unique_stop_count", Json::Node(static_cast<int>(bus->unique_stop_count))},
-                {"route_length", Json::Node(bus->road_route_length)},
-                {"curvature", Json::Node(bus->road_route_length / bus->geo_route_length)},
-            };
+            return {{"error_message", Json::Node("not found"s)}};
         }
-        return dict;
+        return Responses::ToJson(*bus);
     }
 
     struct RouteItemResponseBuilder {
         Json::Dict operator()(const TransportRouter::RouteInfo::BusItem& bus_item) const {
             return Json::Dict{
                 {"type", Json::Node("Bus"s)},
-                {"bus", Json::Node(bus_item.bus_name)},
+                {"bus", Json::Node(string(bus_item.bus_name))},
                 {"time", Json::Node(bus_item.time)},
                 {"span_count", Json::Node(static_cast<int>(bus_item.span_count))}
             };
@@ -52,35 +51,148 @@ namespace Requests {
         Json::Dict operator()(const TransportRouter::RouteInfo::WaitItem& wait_item) const {
             return Json::Dict{
                 {"type", Json::Node("Wait"s)},
-                {"stop_name", Json::Node(wait_item.stop_name)},
+                {"stop_name", Json::Node(string(wait_item.stop_name))},
                 {"time", Json::Node(wait_item.time)},
             };
         }
     };
 
-    Json::Dict Route::Process(const TransportCatalog& db) const {
+    Json::Dict RouteToJson(const TransportRouter::RouteInfo& route) {
         Json::Dict dict;
-        const auto route = db.FindRoute(stop_from, stop_to);
+        dict["total_time"] = Json::Node(route.total_time);
+        vector<Json::Node> items;
+        items.reserve(route.items.size());
+        for (const auto& item : route.items) {
+            items.push_back(visit(RouteItemResponseBuilder{}, item));
+        }
+
+        dict["items"] = move(items);
+        return dict;
+    }
+
+    Json::Dict RouteResponse(const optional<TransportRouter::RouteInfo>& route) {
         if (!route) {
-            dict["error_message"] = Json::Node("not found"s);
-        } else {
-            dict["total_time"] = Json::Node(route->total_time);
-            vector<Json::Node> items;
-            items.reserve(route->items.size());
-            for (const auto& item : route->items) {
-                items.push_back(visit(RouteItemResponseBuilder{}, item));
-            }
+            return {{"error_message", Json::Node("not found"s)}};
+        }
+        return RouteToJson(*route);
+    }
 
-            dict["items"] = move(items);
+    Json::Dict RouteMapResponse(const TransportCatalog& db, const optional<TransportRouter::RouteInfo>& route) {
+        if (!route) {
+            return {{"error_message", Json::Node("not found"s)}};
         }
+        Json::Dict dict = RouteToJson(*route);
+        dict["map"] = Json::Node(db.GetSerializedRouteMap(*route));
         return dict;
     }
 
+    Json::Dict Route::Process(const TransportCatalog& db) const {
+        return RouteResponse(db.FindRoute(stop_from, stop_to));
+    }
+
+    Json::Dict RouteMap::Process(const TransportCatalog& db) const {
+        return RouteMapResponse(db, db.FindRoute(stop_from, stop_to));
+    }
+
+    Json::Dict Nearest::Process(const TransportCatalog& db) const {
+        auto stops = count ? db.FindNearestStops(point, *count) : db.FindStopsWithin(point, *radius);
+        if (count && radius) {
+            erase_if(stops, [this](const Responses::NearbyStop& stop) { return stop.distance > *radius; });
+        }
+
+        vector<Json::Node> stop_nodes;
+        stop_nodes.reserve(stops.size());
+        for (const auto& stop : stops) {
+            stop_nodes.emplace_back(Json::Dict{
+                {"name", Json::Node(string(stop.name))},
+                {"distance", Json::Node(stop.distance)},
+            });
+        }
+        return {{"stops", Json::Node(move(stop_nodes))}};
+    }
+
+    Nearest ReadNearest(const Json::Dict& attrs) {
+        Nearest request{
+            .point = {attrs.at("latitude").AsDouble(), attrs.at("longitude").AsDouble()},
+            .count = nullopt,
+            .radius = nullopt,
+        };
+        if (attrs.count("k") > 0) {
+            const int k = attrs.at("k").AsInt();
+            if (k < 0) {
+                throw invalid_argument("Nearest k must not be negative");
+            }
+            request.count = k;
+        }
+        if (attrs.count("radius") > 0) {
+            request.radius = attrs.at("radius").AsDouble();
+        }
+        if (!request.count && !request.radius) {
+            throw invalid_argument("Nearest needs k or radius");
+        }
+        return request;
+    }
+
     Json::Dict Map::Process(const TransportCatalog& db) const {
-        return {{"map", Json::Node(db.RenderMap())}};
+        return {{"map", Json::Node(db.GetSerializedMap())}};
+    }
+
+    Json::Dict MapTile::Process(const TransportCatalog& db) const {
+        optional<Json::Raw> tile;
+        if (zoom >= 0 && x >= 0 && y >= 0) {
+            tile = db.GetSerializedMapTile(zoom, x, y);
+        }
+        if (!tile) {
+            return {{"error_message", Json::Node("not found"s)}};
+        }
+        return {{"map", Json::Node(move(*tile))}};
+    }
+
+    // Json ints are 32-bit, so byte counts are written as raw numbers
+    Json::Node CountToJson(size_t count) {
+        return Json::Raw{{make_shared<const string>(to_string(count))}};
+    }
+
+    Json::Dict MemoryStats::Process(const TransportCatalog& db) const {
+        Memory::Usage total;
+        vector<Json::Node> components;
+        for (const auto& [name, usage] : db.GetMemoryReport()) {
+            components.push_back(Json::Dict{
+                {"name", Json::Node(name)},
+                {"bytes", CountToJson(usage.bytes)},
+                {"allocations", CountToJson(usage.allocations)},
+            });
+            total += usage;
+        }
+        return {
+            {"components", Json::Node(move(components))},
+            {"total_bytes", CountToJson(total.bytes)},
+            {"total_allocations", CountToJson(total.allocations)},
+        };
+    }
+
+    Json::Dict Stats::Process(const TransportCatalog&) const {
+        vector<Json::Node> metrics;
+        for (auto& [name, labels, value] : Metrics::Collect()) {
+            Json::Dict labels_json;
+            for (auto& [key, label] : labels) {
+                labels_json.emplace(move(key), Json::Node(move(label)));
+            }
+            metrics.push_back(Json::Dict{
+                {"name", Json::Node(move(name))},
+                {"labels", Json::Node(move(labels_json))},
+                {"value", holds_alternative<uint64_t>(value)
+                    ? CountToJson(get<uint64_t>(value))
+                    : Json::Node(get<double>(value))},
+            });
+        }
+        return {
+            {"metrics", Json::Node(move(metrics))},
+            {"uptime_seconds", Json::Node(Metrics::GetUptime())},
+        };
     }
 
-    variant<Stop, Bus, Route, Map> Read(const Json::Dict& attrs) {
+    Request Read(const Json::Dict& attrs) {
         const string& type = attrs.at("type").AsString();
         if (type == "Bus") {
             return Bus{attrs.at("name").AsString()};
@@ -88,22 +200,383 @@ namespace Requests {
             return Stop{attrs.at("name").AsString()};
         } else if (type == "Route") {
             return Route{attrs.at("from").AsString(), attrs.at("to").AsString()};
+        } else if (type == "RouteMap") {
+            return RouteMap{attrs.at("from").AsString(), attrs.at("to").AsString()};
+        } else if (type == "Nearest") {
+            return ReadNearest(attrs);
+        } else if (type == "MemoryStats") {
+            return MemoryStats{};
+        } else if (type == "Stats") {
+            return Stats{};
+        } else if (type == "MapTile") {
+            return MapTile{attrs.at("zoom").AsInt(), attrs.at("x").AsInt(), attrs.at("y").AsInt()};
         } else {
             return Map{};
         }
     }
 
-    vector<Json::Node> ProcessAll(const TransportCatalog& db, const vector<Json::Node>& requests) {
-        vector<Json::Node> responses;
-        responses.reserve(requests.size());
-        for (const Json::Node& request_node : requests) {
-            Json::Dict dict = visit(
-                [&db](const auto& request) { return request.Process(db); },
-                Requests::Read(request_node.AsMap())
+    const Responses::Serialized* FindSerialized(const TransportCatalog& db, const Request& request) {
+        if (const auto* stop = get_if<Stop>(&request)) {
+            return db.GetSerializedStop(stop->name);
+        } else if (const auto* bus = get_if<Bus>(&request)) {
+            return db.GetSerializedBus(bus->name);
+        } else {
+            return nullptr;
+        }
+    }
+
+    // Request types in the order of the Request alternatives
+    constexpr array<string_view, variant_size_v<Request>> REQUEST_TYPES = {
+        "Stop", "Bus", "Route", "RouteMap", "Nearest", "Map", "MapTile", "MemoryStats", "Stats"
+    };
+
+    Profile::LatencyKind GetLatencyKind(const Request& request) {
+        static const auto kinds = [] {
+            array<Profile::LatencyKind, variant_size_v<Request>> kinds;
+            for (size_t index = 0; index < kinds.size(); ++index) {
+                kinds[index] = Profile::RegisterLatencyKind(REQUEST_TYPES[index]);
+            }
+            return kinds;
+        }();
+        return kinds[request.index()];
+    }
+
+    Metrics::Counter& GetRequestCounter(const Request& request) {
+        static const auto counters = [] {
+            array<Metrics::Counter*, variant_size_v<Request>> counters;
+            for (size_t index = 0; index < counters.size(); ++index) {
+                counters[index] = &Metrics::GetCounter(
+                    "transport_requests_total", "Requests answered, by type",
+                    {{"type", string(REQUEST_TYPES[index])}}
+                );
+            }
+            return counters;
+        }();
+        return *counters[request.index()];
+    }
+
+    using Timeout = optional<Deadline::Clock::duration>;
+
+    // The request's own "timeout_ms", or else the catalog's default
+    Timeout GetTimeout(const TransportCatalog& db, const Json::Dict& attrs) {
+        if (attrs.count("timeout_ms") > 0) {
+            return Deadline::FromMilliseconds(attrs.at("timeout_ms").AsDouble());
+        }
+        return db.GetRequestTimeout();
+    }
+
+    Json::Dict TimeoutResponse() {
+        return {{"error_message", Json::Node("timeout"s)}};
+    }
+
+    // Calls answer with a deadline of timeout from now, if any; nullopt if
+    // the deadline passed first
+    template <typename Answer>
+    auto AnswerWithin(Timeout timeout, Answer answer) -> optional<invoke_result_t<Answer>> {
+        if (!timeout) {
+            return answer();
+        }
+        static auto& timeouts = Metrics::GetCounter(
+            "transport_request_timeouts_total", "Computations given up as their deadline passed"
+        );
+        const Deadline deadline(*timeout);
+        ActiveDeadline active_deadline(deadline);
+        try {
+            return answer();
+        } catch (const Deadline::Exceeded&) {
+            timeouts.Add();
+            Profile::TraceCount("timeouts", 1);
+            return nullopt;
+        }
+    }
+
+    // A hit skips both the path search and the conversion of the route;
+    // unknown stops, which need neither, and timeouts are not cached
+    optional<Json::Node> ProcessCachedRoute(const TransportCatalog& db, RouteCache& cache,
+                                            int request_id, const Route& route, Timeout timeout) {
+        static auto& hits = Metrics::GetCounter(
+            "transport_route_cache_total", "Route cache lookups, by result", {{"result", "hit"}}
+        );
+        static auto& misses = Metrics::GetCounter(
+            "transport_route_cache_total", "Route cache lookups, by result", {{"result", "miss"}}
+        );
+        const auto from_id = db.FindStopId(route.stop_from);
+        const auto to_id = db.FindStopId(route.stop_to);
+        if (!from_id || !to_id) {
+            return nullopt;
+        }
+        if (const auto cached = cache.Find(*from_id, *to_id)) {
+            hits.Add();
+            Profile::TraceCount("route_cache_hits", 1);
+            return cached->Splice(request_id);
+        }
+        misses.Add();
+
+        auto dict = AnswerWithin(timeout, [&db, &route] { return route.Process(db); });
+        if (!dict) {
+            Json::Dict response = TimeoutResponse();
+            response["request_id"] = Json::Node(request_id);
+            return Json::Node(move(response));
+        }
+        string text;
+        const auto [head_size, tail_size] = Responses::AppendSerialized(*dict, text);
+        RouteCache::Response response{
+            .head = make_shared<const string>(text.substr(0, head_size)),
+            .tail = make_shared<const string>(text.substr(head_size)),
+        };
+        Json::Node result = response.Splice(request_id);
+        cache.Insert(*from_id, *to_id, move(response));
+        return result;
+    }
+
+    Json::Node ProcessParsed(const TransportCatalog& db, int request_id, const Request& parsed_request,
+                             Timeout timeout) {
+        GetRequestCounter(parsed_request).Add();
+        if (const auto* route = get_if<Route>(&parsed_request); route && db.GetRouteCache()) {
+            if (auto response = ProcessCachedRoute(db, *db.GetRouteCache(), request_id, *route, timeout)) {
+                return move(*response);
+            }
+        }
+        if (const auto* serialized = FindSerialized(db, parsed_request)) {
+            static auto& prebuilt_responses = Metrics::GetCounter(
+                "transport_prebuilt_responses_total", "Responses answered from their build-time serialization"
             );
-                                    
-            dict["request_id"] = Json::Node(request_node.AsMap().at("id").AsInt());
-            responses.push_back(Json::Node(dict));
+            prebuilt_responses.Add();
+            return serialized->Splice(request_id);
+        }
+
+        Json::Dict dict = AnswerWithin(timeout, [&db, &parsed_request] {
+            return visit([&db](const auto& request) { return request.Process(db); }, parsed_request);
+        }).value_or(TimeoutResponse());
+        dict["request_id"] = Json::Node(request_id);
+        return Json::Node(move(dict));
+    }
+
+    // Spans nested as they were opened, with their durations and counts
+    Json::Node TraceToJson(const Profile::Trace& trace) {
+        const auto& spans = trace.GetSpans();
+        // a child comes after its parent, so going backwards every span's
+        // children are complete by the time it is reached
+        vector<vector<Json::Node>> children(spans.size());
+        Json::Node root;
+        for (size_t index = spans.size(); index-- > 0; ) {
+            const auto& span = spans[index];
+            Json::Dict node = {
+                {"name", Json::Node(string(span.name))},
+                {"duration_us", Json::Node(chrono::duration<double, micro>(span.duration).count())},
+            };
+            if (!span.counts.empty()) {
+                Json::Dict counts;
+                for (const auto& [name, value] : span.counts) {
+                    counts.emplace(string(name), CountToJson(value));
+                }
+                node.emplace("counts", move(counts));
+            }
+            if (!children[index].empty()) {
+                reverse(begin(children[index]), end(children[index]));
+                node.emplace("children", move(children[index]));
+            }
+            if (span.parent) {
+                children[*span.parent].push_back(move(node));
+            } else {
+                root = move(node);
+            }
+        }
+        return root;
+    }
+
+    // The response gets a "trace" key with the time taken to read the
+    // request, answer it and serialize the response, and what was done
+    // for each
+    Json::Node ProcessTraced(const TransportCatalog& db, const Json::Dict& request) {
+        Profile::Trace trace;
+        Profile::ActiveTrace active_trace(trace);
+        string response;
+        {
+            TRACE_SPAN("request");
+            const int request_id = request.at("id").AsInt();
+            optional<Request> parsed_request;
+            {
+                TRACE_SPAN("read");
+                parsed_request = Requests::Read(request);
+            }
+            Json::Node response_node;
+            {
+                TRACE_SPAN("answer");
+                response_node = ProcessParsed(db, request_id, *parsed_request, GetTimeout(db, request));
+            }
+            TRACE_SPAN("serialization");
+            ostringstream output;
+            Json::PrintNode(response_node, output);
+            response = move(output).str();
+            Profile::TraceCount("bytes", response.size());
+        }
+
+        // spliced in as the last key of the response dict
+        ostringstream trace_output;
+        Json::PrintNode(TraceToJson(trace), trace_output);
+        response.pop_back();
+        response += ", \"trace\": " + move(trace_output).str() + "}";
+        return Json::Raw{{make_shared<const string>(move(response))}};
+    }
+
+    Json::Node Process(const TransportCatalog& db, const Json::Dict& request) {
+        if (request.count("trace") > 0 && request.at("trace").AsBool()) {
+            return ProcessTraced(db, request);
+        }
+        const bool profiled = Profile::IsEnabled();
+        const auto start = profiled ? Profile::Clock::now() : Profile::Clock::time_point{};
+
+        const int request_id = request.at("id").AsInt();
+        const auto parsed_request = Requests::Read(request);
+        Json::Node response = ProcessParsed(db, request_id, parsed_request, GetTimeout(db, request));
+
+        if (profiled) {
+            Profile::RecordLatency(GetLatencyKind(parsed_request), Profile::Clock::now() - start);
+        }
+        return response;
+    }
+
+    // Requests alike but for their ids share a key; Stats and MemoryStats
+    // describe the moment they are answered, so they get none
+    optional<string> GetDeduplicationKey(const Json::Dict& attrs, const Request& request) {
+        if (holds_alternative<Stats>(request) || holds_alternative<MemoryStats>(request)) {
+            return nullopt;
+        }
+        ostringstream key;
+        // enough digits to tell any two doubles apart
+        key.precision(numeric_limits<double>::max_digits10);
+        for (const auto& [name, value] : attrs) {
+            if (name != "id") {
+                Json::PrintValue(name, key);
+                key << ':';
+                Json::PrintNode(value, key);
+                key << ',';
+            }
+        }
+        return move(key).str();
+    }
+
+    // One computation, and the positions in the batch of the requests it answers
+    struct PlannedAnswer {
+        const Request* request;
+        Timeout timeout;
+        vector<size_t> positions;
+        Json::Dict dict;
+    };
+
+    // Profiled latencies are those of the computations, a shared search
+    // split evenly among its routes. Routes are grouped only with others
+    // of the same timeout, whose deadline counts from the start of the
+    // group's search.
+    vector<Json::Node> ProcessAll(const TransportCatalog& db, const vector<Json::Node>& requests) {
+        static auto& deduplicated = Metrics::GetCounter(
+            "transport_batch_deduplicated_total", "Batch requests answered by the computation of an identical one"
+        );
+        static auto& grouped_routes = Metrics::GetCounter(
+            "transport_batch_grouped_routes_total", "Batch routes found by a search shared with other routes"
+        );
+        const bool profiled = Profile::IsEnabled();
+
+        vector<Json::Node> responses(requests.size());
+        vector<int> request_ids(requests.size());
+        vector<Request> parsed_requests(requests.size());
+        vector<PlannedAnswer> answers;
+        unordered_map<string, size_t> answers_by_key;
+        for (size_t position = 0; position < requests.size(); ++position) {
+            const auto& attrs = requests[position].AsMap();
+            if (attrs.count("trace") > 0 && attrs.at("trace").AsBool()) {
+                responses[position] = Process(db, attrs);
+                continue;
+            }
+            request_ids[position] = attrs.at("id").AsInt();
+            const Request& request = parsed_requests[position] = Requests::Read(attrs);
+            if (FindSerialized(db, request)) {
+                // counted by ProcessParsed, timed here as the other answers below
+                const auto start = profiled ? Profile::Clock::now() : Profile::Clock::time_point{};
+                responses[position] = ProcessParsed(db, request_ids[position], request, GetTimeout(db, attrs));
+                if (profiled) {
+                    Profile::RecordLatency(GetLatencyKind(request), Profile::Clock::now() - start);
+                }
+                continue;
+            }
+            GetRequestCounter(request).Add();
+            if (const auto key = GetDeduplicationKey(attrs, request)) {
+                const auto [it, inserted] = answers_by_key.emplace(*key, answers.size());
+                if (!inserted) {
+                    answers[it->second].positions.push_back(position);
+                    deduplicated.Add();
+                    continue;
+                }
+            }
+            answers.push_back({
+                .request = &request,
+                .timeout = GetTimeout(db, attrs),
+                .positions = {position},
+                .dict = {},
+            });
+        }
+
+        // Route and RouteMap answers by their timeout and source stop
+        map<pair<Timeout, string_view>, vector<size_t>> route_groups;
+        for (size_t index = 0; index < answers.size(); ++index) {
+            auto& answer = answers[index];
+            if (const auto* route = get_if<Route>(answer.request)) {
+                route_groups[{answer.timeout, route->stop_from}].push_back(index);
+            } else if (const auto* route_map = get_if<RouteMap>(answer.request)) {
+                route_groups[{answer.timeout, route_map->stop_from}].push_back(index);
+            } else {
+                const auto start = profiled ? Profile::Clock::now() : Profile::Clock::time_point{};
+                answer.dict = AnswerWithin(answer.timeout, [&db, &answer] {
+                    return visit([&db](const auto& request) { return request.Process(db); }, *answer.request);
+                }).value_or(TimeoutResponse());
+                if (profiled) {
+                    Profile::RecordLatency(GetLatencyKind(*answer.request), Profile::Clock::now() - start);
+                }
+            }
+        }
+        for (const auto& [group, answer_indices] : route_groups) {
+            const auto& [timeout, source] = group;
+            const auto start = profiled ? Profile::Clock::now() : Profile::Clock::time_point{};
+            vector<string_view> targets;
+            targets.reserve(answer_indices.size());
+            for (const size_t index : answer_indices) {
+                const Request& request = *answers[index].request;
+                targets.push_back(
+                    holds_alternative<Route>(request) ? get<Route>(request).stop_to : get<RouteMap>(request).stop_to
+                );
+            }
+            if (answer_indices.size() > 1) {
+                grouped_routes.Add(answer_indices.size());
+            }
+            auto dicts = AnswerWithin(timeout, [&] {
+                const auto routes = db.FindRoutes(source, targets);
+                vector<Json::Dict> dicts;
+                dicts.reserve(routes.size());
+                for (size_t target = 0; target < routes.size(); ++target) {
+                    dicts.push_back(holds_alternative<RouteMap>(*answers[answer_indices[target]].request)
+                        ? RouteMapResponse(db, routes[target])
+                        : RouteResponse(routes[target]));
+                }
+                return dicts;
+            });
+            for (size_t target = 0; target < answer_indices.size(); ++target) {
+                answers[answer_indices[target]].dict = dicts ? move((*dicts)[target]) : TimeoutResponse();
+            }
+            if (profiled) {
+                const auto latency = (Profile::Clock::now() - start) / answer_indices.size();
+                for (const size_t index : answer_indices) {
+                    Profile::RecordLatency(GetLatencyKind(*answers[index].request), latency);
+                }
+            }
+        }
+
+        for (auto& [request, timeout, positions, dict] : answers) {
+            for (size_t index = 0; index < positions.size(); ++index) {
+                Json::Dict response = index + 1 < positions.size() ? dict : move(dict);
+                response["request_id"] = Json::Node(request_ids[positions[index]]);
+                responses[positions[index]] = Json::Node(move(response));
+            }
         }
         return responses;
     }
@@ -3,6 +3,7 @@
 #include "json.h"
 #include "transport_catalog.h"
 
+#include <optional>
 #include <string>
 #include <variant>
 
@@ -26,11 +27,54 @@ namespace Requests {
         Json::Dict Process(const TransportCatalog& db) const;
     };
 
+    // A Route response with the route drawn over the map
+    struct RouteMap {
+        std::string stop_from;
+        std::string stop_to;
+
+        Json::Dict Process(const TransportCatalog& db) const;
+    };
+
+    // Stops nearest to a point: the count nearest, those within radius
+    // meters, or the count nearest of those within radius
+    struct Nearest {
+        Sphere::Point point;
+        std::optional<size_t> count;
+        std::optional<double> radius;
+
+        Json::Dict Process(const TransportCatalog& db) const;
+    };
+
     struct Map {
         Json::Dict Process(const TransportCatalog& db) const;
     };
 
-    std::variant<Stop, Bus, Route, Map> Read(const Json::Dict& attrs);
+    struct MapTile {
+        int zoom;
+        int x;
+        int y;
+
+        Json::Dict Process(const TransportCatalog& db) const;
+    };
+
+    // The catalog's memory report: bytes and heap blocks per component
+    struct MemoryStats {
+        Json::Dict Process(const TransportCatalog& db) const;
+    };
+
+    // Live counters of the process, see Metrics
+    struct Stats {
+        Json::Dict Process(const TransportCatalog& db) const;
+    };
+
+    using Request = std::variant<Stop, Bus, Route, RouteMap, Nearest, Map, MapTile, MemoryStats, Stats>;
+
+    Request Read(const Json::Dict& attrs);
+
+    Json::Node Process(const TransportCatalog& db, const Json::Dict& request);
 
+    // Reads the whole batch first, answers identical requests once and finds
+    // the routes from one stop with a single search, see
+    // TransportCatalog::FindRoutes. Responses are in the order of requests.
     std::vector<Json::Node> ProcessAll(const TransportCatalog& db, const std::vector<Json::Node>& requests);
 }
@@ -0,0 +1,76 @@
+#include "route_cache.h"
+
+using namespace std;
+
+Json::Node RouteCache::Response::Splice(int request_id) const {
+    return Json::Raw{{head, make_shared<const string>(to_string(request_id)), tail}};
+}
+
+RouteCache::RouteCache(size_t capacity_bytes)
+    : shard_capacity_(capacity_bytes / SHARD_COUNT)
+{
+}
+
+RouteCache::Key RouteCache::MakeKey(Network::StopId from, Network::StopId to) {
+    return (Key{from} << 32) | to;
+}
+
+// The text, and a list node and a hash table node per entry
+size_t RouteCache::GetEntryBytes(const Response& response) {
+    static constexpr size_t NODE_BYTES = sizeof(Entries::value_type) + 2 * sizeof(void*)
+        + sizeof(pair<const Key, Entries::iterator>) + 2 * sizeof(void*);
+    return response.head->size() + response.tail->size() + NODE_BYTES;
+}
+
+RouteCache::Shard& RouteCache::GetShard(Key key) {
+    // the high bits of a Fibonacci hash, as stop ids are small and dense
+    return shards_[(key * 0x9E3779B97F4A7C15) >> (64 - SHARD_BITS)];
+}
+
+optional<RouteCache::Response> RouteCache::Find(Network::StopId from, Network::StopId to) {
+    const Key key = MakeKey(from, to);
+    Shard& shard = GetShard(key);
+    lock_guard lock(shard.access);
+    const auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        return nullopt;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    return it->second->second;
+}
+
+void RouteCache::Insert(Network::StopId from, Network::StopId to, Response response) {
+    const size_t bytes = GetEntryBytes(response);
+    if (bytes > shard_capacity_) {
+        return;
+    }
+    const Key key = MakeKey(from, to);
+    Shard& shard = GetShard(key);
+    lock_guard lock(shard.access);
+    // another thread may have answered the same route meanwhile
+    if (shard.index.count(key) > 0) {
+        return;
+    }
+    shard.entries.emplace_front(key, move(response));
+    shard.index.emplace(key, shard.entries.begin());
+    shard.bytes += bytes;
+    while (shard.bytes > shard_capacity_) {
+        const auto& [oldest_key, oldest_response] = shard.entries.back();
+        shard.bytes -= GetEntryBytes(oldest_response);
+        shard.index.erase(oldest_key);
+        shard.entries.pop_back();
+    }
+}
+
+Memory::Usage RouteCache::GetMemoryUsage() const {
+    Memory::Usage usage;
+    for (const Shard& shard : shards_) {
+        lock_guard lock(shard.access);
+        usage += Memory::GetHashTableUsage(shard.index);
+        usage += {shard.entries.size() * (sizeof(Entries::value_type) + 2 * sizeof(void*)), shard.entries.size()};
+        for (const auto& [key, response] : shard.entries) {
+            usage += Memory::GetStringUsage(*response.head) + Memory::GetStringUsage(*response.tail);
+        }
+    }
+    return usage;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "json.h"
+#include "memory_usage.h"
+#include "network.h"
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Serialized Route responses by (from, to) stop ids, dropping the least
+// recently used ones once the bytes held pass the capacity. Split into
+// shards with a lock each, so server threads rarely wait on one another.
+class RouteCache {
+public:
+    // A response printed once and split where its request_id goes; the
+    // halves are shared by every response made of it
+    struct Response {
+        std::shared_ptr<const std::string> head;
+        std::shared_ptr<const std::string> tail;
+
+        Json::Node Splice(int request_id) const;
+    };
+
+    explicit RouteCache(size_t capacity_bytes);
+
+    std::optional<Response> Find(Network::StopId from, Network::StopId to);
+    // Responses bigger than a shard's share of the capacity are not kept
+    void Insert(Network::StopId from, Network::StopId to, Response response);
+
+    Memory::Usage GetMemoryUsage() const;
+
+private:
+    static constexpr size_t SHARD_BITS = 4;
+    static constexpr size_t SHARD_COUNT = 1 << SHARD_BITS;
+
+    using Key = uint64_t;
+    using Entries = std::list<std::pair<Key, Response>>;
+
+    struct alignas(64) Shard {
+        mutable std::mutex access;
+        Entries entries;  // most recently used first
+        std::unordered_map<Key, Entries::iterator> index;
+        size_t bytes = 0;
+    };
+
+    static Key MakeKey(Network::StopId from, Network::StopId to);
+    static size_t GetEntryBytes(const Response& response);
+    Shard& GetShard(Key key);
+
+    size_t shard_capacity_;
+    std::array<Shard, SHARD_COUNT> shards_;
+};
@@ -1,50 +1,79 @@
 #pragma once
 
+#include "deadline.h"
 #include "graph.h"
+#include "memory_usage.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <iterator>
+#include <functional>
 #include <optional>
-#include <unordered_map>
+#include <queue>
 #include <utility>
 #include <vector>
 
 namespace Graph {
 
+    // AllPairs precomputes every route into a table of vertex count squared
+    // items; Dijkstra keeps nothing and searches from the start on every
+    // BuildRoute
+    enum class RouterEngine {
+        AllPairs,
+        Dijkstra,
+    };
+
     template <typename Weight>
     class Router {
     private:
         using Graph = DirectedWeightedGraph<Weight>;
 
     public:
-        Router(const Graph& graph);
+        explicit Router(const Graph& graph, RouterEngine engine = RouterEngine::AllPairs);
 
-        using RouteId = uint64_t;
+        // Heap bytes of the AllPairs table, to check before building it
+        static size_t EstimateAllPairsBytes(size_t vertex_count);
 
+        // Routes carry their own edges, so concurrent searches share nothing
         struct RouteInfo {
-            RouteId id;
             Weight weight;
-            size_t edge_count;
+            std::vector<EdgeId> edges;
+        };
+
+        // Work done by a Dijkstra search; AllPairs does none per route
+        struct SearchWork {
+            size_t settled_vertex_count = 0;
+            size_t relaxed_edge_count = 0;
         };
 
-        std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
-        EdgeId GetRouteEdge(RouteId route_id, size_t edge_idx) const;
-        void ReleaseRoute(RouteId route_id);
+        std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to, SearchWork* work = nullptr) const;
+        // Routes from one vertex to each of targets, in their order; Dijkstra
+        // answers them all with a single search
+        std::vector<std::optional<RouteInfo>> BuildRoutes(VertexId from, const std::vector<VertexId>& targets,
+                                                          SearchWork* work = nullptr) const;
+
+        // The AllPairs table
+        Memory::Usage GetMemoryUsage() const;
 
     private:
         const Graph& graph_;
+        RouterEngine engine_;
 
         struct RouteInternalData {
             Weight weight;
             std::optional<EdgeId> prev_edge;
         };
-        using RoutesInternalData = std::vector<std::vector<std::optional<RouteInternalData>>>;
+        // Best known routes from one vertex, by target vertex
+        using RoutesFrom = std::vector<std::optional<RouteInternalData>>;
+        using RoutesInternalData = std::vector<RoutesFrom>;
 
-        using ExpandedRoute = std::vector<EdgeId>;
-        mutable RouteId next_route_id_ = 0;
-        mutable std::unordered_map<RouteId, ExpandedRoute> expanded_routes_cache_;
+        // Stops as soon as the routes to all targets are final. Checks the
+        // active deadline once per so many settled vertices.
+        static constexpr size_t DEADLINE_CHECK_PERIOD = 256;
+        RoutesFrom ComputeRoutesFrom(VertexId vertex_from, const std::vector<VertexId>& targets,
+                                     SearchWork& work) const;
+        std::optional<RouteInfo> ExpandRoute(const RoutesFrom& routes_from, VertexId to) const;
 
         void InitializeRoutesInternalData(const Graph& graph) {
             const size_t vertex_count = graph.GetVertexCount();
@@ -92,21 +121,115 @@ namespace Graph {
 
 
     template <typename Weight>
-    Router<Weight>::Router(const Graph& graph)
+    Router<Weight>::Router(const Graph& graph, RouterEngine engine)
         : graph_(graph),
-        routes_internal_data_(graph.GetVertexCount(), std::vector<std::optional<RouteInternalData>>(graph.GetVertexCount()))
+        engine_(engine)
     {
+        if (engine_ == RouterEngine::Dijkstra) {
+            return;
+        }
+        const size_t vertex_count = graph.GetVertexCount();
+        routes_internal_data_.assign(vertex_count, RoutesFrom(vertex_count));
         InitializeRoutesInternalData(graph);
 
-        const size_t vertex_count = graph.GetVertexCount();
         for (VertexId vertex_through = 0; vertex_through < vertex_count; ++vertex_through) {
             RelaxRoutesInternalDataThroughVertex(vertex_count, vertex_through);
         }
     }
 
     template <typename Weight>
-    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexId from, VertexId to) const {
-        const auto& route_internal_data = routes_internal_data_[from][to];
+    size_t Router<Weight>::EstimateAllPairsBytes(size_t vertex_count) {
+        return vertex_count * (sizeof(RoutesFrom) + vertex_count * sizeof(typename RoutesFrom::value_type));
+    }
+
+    template <typename Weight>
+    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexId from, VertexId to,
+                                                                                 SearchWork* work) const {
+        if (engine_ == RouterEngine::Dijkstra) {
+            SearchWork search_work;
+            auto route = ExpandRoute(ComputeRoutesFrom(from, {to}, search_work), to);
+            if (work) {
+                *work = search_work;
+            }
+            return route;
+        }
+        return ExpandRoute(routes_internal_data_[from], to);
+    }
+
+    template <typename Weight>
+    std::vector<std::optional<typename Router<Weight>::RouteInfo>> Router<Weight>::BuildRoutes(
+            VertexId from, const std::vector<VertexId>& targets, SearchWork* work) const {
+        std::vector<std::optional<RouteInfo>> routes;
+        routes.reserve(targets.size());
+        if (engine_ == RouterEngine::Dijkstra) {
+            SearchWork search_work;
+            const RoutesFrom routes_from = ComputeRoutesFrom(from, targets, search_work);
+            for (const VertexId to : targets) {
+                routes.push_back(ExpandRoute(routes_from, to));
+            }
+            if (work) {
+                *work = search_work;
+            }
+            return routes;
+        }
+        for (const VertexId to : targets) {
+            routes.push_back(ExpandRoute(routes_internal_data_[from], to));
+        }
+        return routes;
+    }
+
+    template <typename Weight>
+    typename Router<Weight>::RoutesFrom Router<Weight>::ComputeRoutesFrom(VertexId vertex_from,
+                                                                          const std::vector<VertexId>& targets,
+                                                                          SearchWork& work) const {
+        RoutesFrom routes_from(graph_.GetVertexCount());
+        routes_from[vertex_from] = RouteInternalData{0, std::nullopt};
+
+        std::vector<bool> is_pending_target(graph_.GetVertexCount());
+        size_t pending_target_count = 0;
+        for (const VertexId target : targets) {
+            if (!is_pending_target[target]) {
+                is_pending_target[target] = true;
+                ++pending_target_count;
+            }
+        }
+
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+        queue.push({0, vertex_from});
+        while (!queue.empty()) {
+            const auto [weight, vertex] = queue.top();
+            queue.pop();
+            if (weight > routes_from[vertex]->weight) {
+                continue;  // superseded by a shorter route pushed later
+            }
+            if (++work.settled_vertex_count % DEADLINE_CHECK_PERIOD == 0) {
+                Deadline::CheckActive();
+            }
+            if (is_pending_target[vertex]) {
+                is_pending_target[vertex] = false;
+                if (--pending_target_count == 0) {
+                    break;
+                }
+            }
+            for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+                ++work.relaxed_edge_count;
+                const auto& edge = graph_.GetEdge(edge_id);
+                assert(edge.weight >= 0);
+                auto& route_to = routes_from[edge.to];
+                const Weight candidate_weight = weight + edge.weight;
+                if (!route_to || candidate_weight < route_to->weight) {
+                    route_to = RouteInternalData{candidate_weight, edge_id};
+                    queue.push({candidate_weight, edge.to});
+                }
+            }
+        }
+        return routes_from;
+    }
+
+    template <typename Weight>
+    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::ExpandRoute(const RoutesFrom& routes_from, VertexId to) const {
+        const auto& route_internal_data = routes_from[to];
         if (!route_internal_data) {
             return std::nullopt;
         }
@@ -114,25 +237,20 @@ namespace Graph {
         std::vector<EdgeId> edges;
         for (std::optional<EdgeId> edge_id = route_internal_data->prev_edge;
             edge_id;
-            edge_id = routes_internal_data_[from][graph_.GetEdge(*edge_id).from]->prev_edge) {
+            edge_id = routes_from[graph_.GetEdge(*edge_id).from]->prev_edge) {
             edges.push_back(*edge_id);
         }
         std::reverse(std::begin(edges), std::end(edges));
-
-        const RouteId route_id = next_route_id_++;
-        const size_t route_edge_count = edges.size();
-        expanded_routes_cache_[route_id] = std::move(edges);
-        return RouteInfo{route_id, weight, route_edge_count};
+        return RouteInfo{weight, std::move(edges)};
     }
 
     template <typename Weight>
-    EdgeId Router<Weight>::GetRouteEdge(RouteId route_id, size_t edge_idx) const {
-        return expanded_routes_cache_.at(route_id)[edge_idx];
-    }
-
-    template <typename Weight>
-    void Router<Weight>::ReleaseRoute(RouteId route_id) {
-        expanded_routes_cache_.erase(route_id);
+    Memory::Usage Router<Weight>::GetMemoryUsage() const {
+        Memory::Usage usage = Memory::GetVectorUsage(routes_internal_data_);
+        for (const auto& routes_from : routes_internal_data_) {
+            usage += Memory::GetVectorUsage(routes_from);
+        }
+        return usage;
     }
 
 }
\ No newline at end of file
@@ -0,0 +1,333 @@
+#include "server.h"
+#include "metrics.h"
+#include "requests.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace Server {
+
+    string MakeErrorLine(string message) {
+        ostringstream output;
+        Json::PrintValue(Json::Dict{{"error_message", Json::Node(move(message))}}, output);
+        output << '\n';
+        return output.str();
+    }
+
+    string ProcessLine(const TransportCatalog& db, string_view line) {
+        ostringstream output;
+        try {
+            istringstream input{string(line)};
+            const auto request = Json::Load(input);
+            Json::PrintNode(Requests::Process(db, request.GetRoot().AsMap()), output);
+        } catch (const exception&) {
+            static auto& errors = Metrics::GetCounter("transport_request_errors_total", "Request lines that failed");
+            errors.Add();
+            return MakeErrorLine("bad request");
+        }
+        output << '\n';
+        return output.str();
+    }
+
+    void ServeStream(const SharedCatalog& catalog, istream& input, ostream& output) {
+        for (string line; getline(input, line); ) {
+            if (Strip(line).empty()) {
+                continue;
+            }
+            output << ProcessLine(*catalog.Get(), line) << flush;
+        }
+    }
+
+    bool SendAll(int fd, string_view data) {
+        while (!data.empty()) {
+            const ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data.remove_prefix(sent);
+        }
+        return true;
+    }
+
+    // no request comes near this, so a longer line is a broken client
+    static constexpr size_t MAX_LINE_BYTES = 1 << 20;
+    // connections beyond this are turned away as soon as they are accepted
+    static constexpr size_t MAX_CONNECTIONS = 1024;
+    // a client that sends nothing for this long is disconnected
+    static constexpr chrono::seconds IDLE_TIMEOUT{60};
+    // a client that does not read its answers holds a worker no longer
+    static constexpr chrono::seconds SEND_TIMEOUT{10};
+    // how often idle connections are looked for when nothing happens
+    static constexpr int POLL_PERIOD_MS = 1000;
+
+    // One thread polls the listening socket and every connection. The
+    // complete lines read from a connection go to the pool as one job, and
+    // the connection is not read again until that job is done, so answers
+    // keep the order of their requests and a silent client holds no worker.
+    class ConnectionLoop {
+    public:
+        ConnectionLoop(const SharedCatalog& catalog, int listen_fd, size_t thread_count)
+            : catalog_(catalog),
+              listen_fd_(listen_fd),
+              pool_(thread_count)
+        {
+            if (pipe2(wake_fds_, O_NONBLOCK | O_CLOEXEC) < 0) {
+                throw system_error(errno, generic_category(), "pipe");
+            }
+        }
+
+        [[noreturn]] void Run() {
+            for (;;) {
+                vector<pollfd> fds = {{listen_fd_, POLLIN, 0}, {wake_fds_[0], POLLIN, 0}};
+                for (const auto& [fd, connection] : connections_) {
+                    if (!connection.busy) {
+                        fds.push_back({fd, POLLIN, 0});
+                    }
+                }
+                if (poll(fds.data(), fds.size(), POLL_PERIOD_MS) < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw system_error(errno, generic_category(), "poll");
+                }
+                if (fds[1].revents != 0) {
+                    CollectFinished();
+                }
+                for (size_t i = 2; i < fds.size(); ++i) {
+                    if (fds[i].revents != 0) {
+                        Read(fds[i].fd);
+                    }
+                }
+                if (fds[0].revents != 0) {
+                    Accept();
+                }
+                CloseIdle();
+            }
+        }
+
+    private:
+        using Clock = chrono::steady_clock;
+
+        struct Connection {
+            string buffer;
+            // a job answers its lines, so it is not polled meanwhile
+            bool busy = false;
+            Clock::time_point last_active;
+        };
+
+        void Accept() {
+            const int fd = accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    return;
+                }
+                throw system_error(errno, generic_category(), "accept");
+            }
+            if (connections_.size() >= MAX_CONNECTIONS) {
+                static auto& rejected = Metrics::GetCounter(
+                    "transport_connections_rejected_total", "Connections closed at once as too many were open"
+                );
+                rejected.Add();
+                // nothing was sent on it yet, so this does not block
+                SendAll(fd, MakeErrorLine("too many connections"));
+                close(fd);
+                return;
+            }
+            static auto& accepted = Metrics::GetCounter("transport_connections_total", "Connections accepted");
+            accepted.Add();
+            const timeval send_timeout{.tv_sec = SEND_TIMEOUT.count(), .tv_usec = 0};
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+            connections_[fd].last_active = Clock::now();
+        }
+
+        void Read(int fd) {
+            Connection& connection = connections_.at(fd);
+            char chunk[4096];
+            const ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+            if (received < 0 && errno == EINTR) {
+                return;
+            }
+            if (received <= 0) {
+                Close(fd);
+                return;
+            }
+            connection.last_active = Clock::now();
+            connection.buffer.append(chunk, received);
+
+            vector<string> lines;
+            string_view pending = connection.buffer;
+            for (size_t pos; (pos = pending.find('\n')) != string_view::npos; ) {
+                const string_view line = pending.substr(0, pos);
+                pending.remove_prefix(pos + 1);
+                if (!Strip(line).empty()) {
+                    lines.emplace_back(line);
+                }
+            }
+            connection.buffer.erase(0, connection.buffer.size() - pending.size());
+            const bool is_too_long = connection.buffer.size() > MAX_LINE_BYTES;
+            if (lines.empty() && !is_too_long) {
+                return;
+            }
+            connection.busy = true;
+            pool_.Submit([this, fd, lines = move(lines), is_too_long] {
+                bool keep_open = true;
+                for (const string& line : lines) {
+                    if (!SendAll(fd, ProcessLine(*catalog_.Get(), line))) {
+                        keep_open = false;
+                        break;
+                    }
+                }
+                if (keep_open && is_too_long) {
+                    static auto& errors = Metrics::GetCounter("transport_request_errors_total", "Request lines that failed");
+                    errors.Add();
+                    SendAll(fd, MakeErrorLine("request line too long"));
+                    keep_open = false;
+                }
+                Finish(fd, keep_open);
+            });
+        }
+
+        // Called by the workers
+        void Finish(int fd, bool keep_open) {
+            {
+                lock_guard lock(finished_mutex_);
+                finished_.emplace_back(fd, keep_open);
+            }
+            const char wake = 0;
+            // a full pipe already has the loop woken
+            [[maybe_unused]] const ssize_t written = write(wake_fds_[1], &wake, 1);
+        }
+
+        void CollectFinished() {
+            char drained[256];
+            while (read(wake_fds_[0], drained, sizeof(drained)) > 0) {
+            }
+            vector<pair<int, bool>> finished;
+            {
+                lock_guard lock(finished_mutex_);
+                swap(finished, finished_);
+            }
+            for (const auto& [fd, keep_open] : finished) {
+                if (keep_open) {
+                    Connection& connection = connections_.at(fd);
+                    connection.busy = false;
+                    connection.last_active = Clock::now();
+                } else {
+                    Close(fd);
+                }
+            }
+        }
+
+        void CloseIdle() {
+            const auto now = Clock::now();
+            for (auto it = begin(connections_); it != end(connections_); ) {
+                const auto& [fd, connection] = *it;
+                if (!connection.busy && now - connection.last_active > IDLE_TIMEOUT) {
+                    close(fd);
+                    it = connections_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        void Close(int fd) {
+            close(fd);
+            connections_.erase(fd);
+        }
+
+        const SharedCatalog& catalog_;
+        const int listen_fd_;
+        int wake_fds_[2];
+        unordered_map<int, Connection> connections_;
+        mutex finished_mutex_;
+        vector<pair<int, bool>> finished_;  // connection, whether to keep it open
+        ThreadPool pool_;
+    };
+
+    void ServeSocket(const SharedCatalog& catalog, const string& socket_path, size_t thread_count) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path)) {
+            throw invalid_argument("socket path is too long: " + socket_path);
+        }
+        copy(begin(socket_path), end(socket_path), address.sun_path);
+
+        const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            throw system_error(errno, generic_category(), "socket");
+        }
+        unlink(socket_path.c_str());
+        if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+            throw system_error(errno, generic_category(), "bind " + socket_path);
+        }
+        if (listen(listen_fd, SOMAXCONN) < 0) {
+            throw system_error(errno, generic_category(), "listen " + socket_path);
+        }
+        signal(SIGPIPE, SIG_IGN);
+
+        ConnectionLoop(catalog, listen_fd, thread_count).Run();
+    }
+
+    HangupReloader::HangupReloader(SharedCatalog& catalog, CatalogLoader load) {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        thread_ = thread([this, &catalog, load = move(load), signals] {
+            // nice value is per thread on Linux: let the query threads win the CPU
+            setpriority(PRIO_PROCESS, 0, 10);
+            for (int signal_number; !stopping_ && sigwait(&signals, &signal_number) == 0; ) {
+                // the destructor wakes the thread with a SIGHUP of its own
+                if (stopping_) {
+                    break;
+                }
+                static auto& reloads = Metrics::GetCounter(
+                    "transport_catalog_reloads_total", "Catalog reloads, by result", {{"result", "ok"}}
+                );
+                static auto& failed_reloads = Metrics::GetCounter(
+                    "transport_catalog_reloads_total", "Catalog reloads, by result", {{"result", "failed"}}
+                );
+                try {
+                    SharedCatalog::Retire(catalog.Publish(load()));
+                    reloads.Add();
+                    cerr << "catalog reloaded" << endl;
+                } catch (const exception& e) {
+                    failed_reloads.Add();
+                    cerr << "catalog reload failed, keeping the current one: " << e.what() << endl;
+                }
+            }
+        });
+    }
+
+    HangupReloader::~HangupReloader() {
+        stopping_ = true;
+        pthread_kill(thread_.native_handle(), SIGHUP);
+        thread_.join();
+    }
+}
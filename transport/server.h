@@ -0,0 +1,46 @@
+#pragma once
+
+#include "shared_catalog.h"
+#include "transport_catalog.h"
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// Resident mode: the catalog is built once and then every input line
+// holds one stat request, answered by exactly one output line.
+namespace Server {
+
+    std::string ProcessLine(const TransportCatalog& db, std::string_view line);
+
+    // Every line is answered by the catalog version current at the time it is read
+    void ServeStream(const SharedCatalog& catalog, std::istream& input, std::ostream& output);
+
+    // Blocks forever. One thread watches the connections and thread_count
+    // workers answer the lines they send; idle connections are closed.
+    void ServeSocket(const SharedCatalog& catalog, const std::string& socket_path, size_t thread_count);
+
+    using CatalogLoader = std::function<SharedCatalog::Snapshot()>;
+
+    // Rebuilds the catalog with load on a low-priority background thread on
+    // every SIGHUP and publishes it when ready; queries keep being answered
+    // by the old version meanwhile. Must be created before any other thread
+    // is started, as SIGHUP is blocked for the threads created afterwards.
+    // Its destructor waits for a reload in progress and stops the thread, so
+    // it must be destroyed before catalog.
+    class HangupReloader {
+    public:
+        HangupReloader(SharedCatalog& catalog, CatalogLoader load);
+        ~HangupReloader();
+
+        HangupReloader(const HangupReloader&) = delete;
+        HangupReloader& operator=(const HangupReloader&) = delete;
+
+    private:
+        std::atomic<bool> stopping_ = false;
+        std::thread thread_;
+    };
+}
@@ -0,0 +1,24 @@
+#include "shared_catalog.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+SharedCatalog::SharedCatalog(Snapshot initial) : current_(move(initial)) {}
+
+SharedCatalog::Snapshot SharedCatalog::Get() const {
+    return current_.load(memory_order_acquire);
+}
+
+SharedCatalog::Snapshot SharedCatalog::Publish(Snapshot next) {
+    return current_.exchange(move(next), memory_order_acq_rel);
+}
+
+void SharedCatalog::Retire(Snapshot previous) {
+    // previous is unpublished, so no reader can take a new reference to it
+    while (previous.use_count() > 1) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    previous.reset();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "transport_catalog.h"
+
+#include <atomic>
+#include <memory>
+
+// Holds the catalog version that is currently served. Readers copy the
+// snapshot pointer and keep using their version for the whole request,
+// while a replacement is built elsewhere and swapped in with Publish.
+class SharedCatalog {
+public:
+    using Snapshot = std::shared_ptr<const TransportCatalog>;
+
+    explicit SharedCatalog(Snapshot initial);
+
+    Snapshot Get() const;
+
+    // Returns the previous version, which is freed once its last reader
+    // releases it; see Retire
+    Snapshot Publish(Snapshot next);
+
+    // Waits for the readers of a replaced version and destroys it on the
+    // calling thread, so tearing down a big catalog never lands on a reader
+    static void Retire(Snapshot previous);
+
+private:
+    std::atomic<Snapshot> current_;
+};
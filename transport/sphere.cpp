@@ -1,6 +1,13 @@
 #include "sphere.h"
 #include "utils.h"
 
+#include <algorithm>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define SPHERE_AVX2_KERNEL
+#endif
+
 using namespace std;
 
 namespace Sphere {
@@ -20,11 +27,207 @@ namespace Sphere {
     const double EARTH_RADIUS = 6'371'000;
 
     double Distance(Point lhs, Point rhs) {
-        lhs = Point::FromDegrees(lhs.latitude, lhs.longitude);
-        rhs = Point::FromDegrees(rhs.latitude, rhs.longitude);
-        return acos(
-            sin(lhs.latitude) * sin(rhs.latitude)
-            + cos(lhs.latitude) * cos(rhs.latitude) * cos(abs(lhs.longitude - rhs.longitude))
-        ) * EARTH_RADIUS;
+        return Distance(PreparedPoint::FromDegrees(lhs), PreparedPoint::FromDegrees(rhs));
+    }
+
+    PreparedPoint PreparedPoint::FromDegrees(Point point) {
+        const Point radians = Point::FromDegrees(point.latitude, point.longitude);
+        return {
+            .latitude = radians.latitude,
+            .longitude = radians.longitude,
+            .sin_latitude = sin(radians.latitude),
+            .cos_latitude = cos(radians.latitude),
+        };
+    }
+
+    double Distance(const PreparedPoint& lhs, const PreparedPoint& rhs) {
+        // rounding can take the cosine of a zero or a straight angle past 1
+        // or -1
+        return acos(clamp(
+            lhs.sin_latitude * rhs.sin_latitude
+            + lhs.cos_latitude * rhs.cos_latitude * cos(abs(lhs.longitude - rhs.longitude)),
+            -1.0, 1.0
+        )) * EARTH_RADIUS;
+    }
+
+    UnitVector UnitVector::FromPoint(const PreparedPoint& point) {
+        return {
+            point.cos_latitude * cos(point.longitude),
+            point.cos_latitude * sin(point.longitude),
+            point.sin_latitude,
+        };
+    }
+
+    double ComputeChord(const UnitVector& lhs, const UnitVector& rhs) {
+        return sqrt(
+            (lhs.x - rhs.x) * (lhs.x - rhs.x)
+            + (lhs.y - rhs.y) * (lhs.y - rhs.y)
+            + (lhs.z - rhs.z) * (lhs.z - rhs.z)
+        );
+    }
+
+    double ComputeChord(double distance) {
+        return 2 * sin(min(distance / EARTH_RADIUS, PI) / 2);
+    }
+
+#ifdef SPHERE_AVX2_KERNEL
+    // Four lanes of cos and acos after fdlibm's k_cos, k_sin and e_acos
+
+    __attribute__((target("avx2,fma")))
+    __m256d Polynomial(__m256d x, initializer_list<double> coefs) {
+        auto it = rbegin(coefs);
+        __m256d result = _mm256_set1_pd(*it++);
+        for (; it != rend(coefs); ++it) {
+            result = _mm256_fmadd_pd(result, x, _mm256_set1_pd(*it));
+        }
+        return result;
+    }
+
+    __attribute__((target("avx2,fma")))
+    __m256d Cos(__m256d x) {
+        // x = n * pi/2 + r, |r| <= pi/4, with pi/2 split in two parts
+        const __m256d n = _mm256_round_pd(
+            _mm256_mul_pd(x, _mm256_set1_pd(6.36619772367581382433e-01)),
+            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC
+        );
+        __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(1.57079632673412561417e+00), x);
+        r = _mm256_fnmadd_pd(n, _mm256_set1_pd(6.07710050650619224932e-11), r);
+        const __m256d z = _mm256_mul_pd(r, r);
+
+        const __m256d cos_tail = _mm256_mul_pd(z, Polynomial(z, {
+            4.16666666666666019037e-02, -1.38888888888741095749e-03, 2.48015872894767294178e-05,
+            -2.75573143513906633035e-07, 2.08757232129817482790e-09, -1.13596475577881948265e-11,
+        }));
+        const __m256d half_z = _mm256_mul_pd(z, _mm256_set1_pd(0.5));
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d w = _mm256_sub_pd(one, half_z);
+        const __m256d cos_r = _mm256_add_pd(
+            w, _mm256_fmadd_pd(z, cos_tail, _mm256_sub_pd(_mm256_sub_pd(one, w), half_z))
+        );
+        const __m256d sin_r = _mm256_fmadd_pd(_mm256_mul_pd(z, r), Polynomial(z, {
+            -1.66666666666666324348e-01, 8.33333333332248946124e-03, -1.98412698298579493134e-04,
+            2.75573137070700676789e-06, -2.50507602534068634195e-08, 1.58969099521155010221e-10,
+        }), r);
+
+        // quadrants 0..3 give cos r, -sin r, -cos r, sin r
+        const __m256i quadrant = _mm256_and_si256(
+            _mm256_castpd_si256(_mm256_add_pd(n, _mm256_set1_pd(0x1p52))), _mm256_set1_epi64x(3)
+        );
+        const __m256d use_sin = _mm256_castsi256_pd(_mm256_cmpeq_epi64(
+            _mm256_and_si256(quadrant, _mm256_set1_epi64x(1)), _mm256_set1_epi64x(1)
+        ));
+        const __m256d negate = _mm256_castsi256_pd(_mm256_slli_epi64(
+            _mm256_xor_si256(_mm256_srli_epi64(quadrant, 1), _mm256_and_si256(quadrant, _mm256_set1_epi64x(1))),
+            63
+        ));
+        return _mm256_xor_pd(_mm256_blendv_pd(cos_r, sin_r, use_sin), negate);
+    }
+
+    __attribute__((target("avx2,fma")))
+    __m256d AcosRational(__m256d z) {
+        const __m256d p = _mm256_mul_pd(z, Polynomial(z, {
+            1.66666666666666657415e-01, -3.25565818622400915405e-01, 2.01212532134862925881e-01,
+            -4.00555345006794114027e-02, 7.91534994289814532176e-04, 3.47933107596021167570e-05,
+        }));
+        const __m256d q = Polynomial(z, {
+            1.0, -2.40339491173441421878e+00, 2.02094576023350569471e+00,
+            -6.88283971605453293030e-01, 7.70381505559019352791e-02,
+        });
+        return _mm256_div_pd(p, q);
+    }
+
+    __attribute__((target("avx2,fma")))
+    __m256d Acos(__m256d x) {
+        const __m256d half = _mm256_set1_pd(0.5);
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d pio2_hi = _mm256_set1_pd(1.57079632679489655800e+00);
+        const __m256d pio2_lo = _mm256_set1_pd(6.12323399573676603587e-17);
+        const __m256d abs_x = _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+
+        // |x| < 0.5: pi/2 - (x + x * R(x^2))
+        const __m256d small_r = AcosRational(_mm256_mul_pd(x, x));
+        const __m256d small = _mm256_sub_pd(
+            pio2_hi, _mm256_sub_pd(x, _mm256_fnmadd_pd(x, small_r, pio2_lo))
+        );
+
+        // |x| >= 0.5: z = (1 - |x|) / 2, acos |x| = 2 * (sqrt z + sqrt z * R(z))
+        const __m256d z = _mm256_mul_pd(_mm256_sub_pd(one, abs_x), half);
+        const __m256d s = _mm256_sqrt_pd(z);
+        const __m256d big_r = AcosRational(z);
+        // positive x: s is split in df + c for the extra precision near 1
+        const __m256d df = _mm256_and_pd(s, _mm256_castsi256_pd(_mm256_set1_epi64x(0xFFFFFFFF00000000)));
+        // at x = 1 both s and df are 0, and so is c rather than 0 / 0
+        const __m256d c = _mm256_div_pd(
+            _mm256_fnmadd_pd(df, df, z), _mm256_max_pd(_mm256_add_pd(s, df), _mm256_set1_pd(0x1p-1022))
+        );
+        const __m256d positive = _mm256_mul_pd(
+            _mm256_set1_pd(2.0), _mm256_add_pd(df, _mm256_fmadd_pd(big_r, s, c))
+        );
+        const __m256d negative = _mm256_fnmadd_pd(
+            _mm256_set1_pd(2.0),
+            _mm256_add_pd(s, _mm256_fmsub_pd(big_r, s, pio2_lo)),
+            _mm256_set1_pd(3.14159265358979311600e+00)
+        );
+
+        const __m256d big = _mm256_blendv_pd(positive, negative, x);
+        return _mm256_blendv_pd(small, big, _mm256_cmp_pd(abs_x, half, _CMP_GE_OQ));
+    }
+
+    // Loads four points as rows and transposes them to one field per register
+    __attribute__((target("avx2,fma")))
+    void LoadPoints(const PreparedPoint* points,
+                    __m256d& longitude, __m256d& sin_latitude, __m256d& cos_latitude) {
+        static_assert(sizeof(PreparedPoint) == 4 * sizeof(double));
+        const double* data = &points->latitude;
+        const __m256d row0 = _mm256_loadu_pd(data);
+        const __m256d row1 = _mm256_loadu_pd(data + 4);
+        const __m256d row2 = _mm256_loadu_pd(data + 8);
+        const __m256d row3 = _mm256_loadu_pd(data + 12);
+        const __m256d lat_sin01 = _mm256_unpacklo_pd(row0, row1);
+        const __m256d lon_cos01 = _mm256_unpackhi_pd(row0, row1);
+        const __m256d lat_sin23 = _mm256_unpacklo_pd(row2, row3);
+        const __m256d lon_cos23 = _mm256_unpackhi_pd(row2, row3);
+        longitude = _mm256_permute2f128_pd(lon_cos01, lon_cos23, 0x20);
+        sin_latitude = _mm256_permute2f128_pd(lat_sin01, lat_sin23, 0x31);
+        cos_latitude = _mm256_permute2f128_pd(lon_cos01, lon_cos23, 0x31);
+    }
+
+    __attribute__((target("avx2,fma")))
+    void ComputeDistancesAvx2(const PreparedPoint* lhs, const PreparedPoint* rhs,
+                              double* distances, size_t count) {
+        for (size_t i = 0; i < count; i += 4) {
+            __m256d lhs_longitude, lhs_sin, lhs_cos, rhs_longitude, rhs_sin, rhs_cos;
+            LoadPoints(lhs + i, lhs_longitude, lhs_sin, lhs_cos);
+            LoadPoints(rhs + i, rhs_longitude, rhs_sin, rhs_cos);
+
+            const __m256d cos_delta = Cos(_mm256_andnot_pd(
+                _mm256_set1_pd(-0.0), _mm256_sub_pd(lhs_longitude, rhs_longitude)
+            ));
+            const __m256d cos_angle = _mm256_add_pd(
+                _mm256_mul_pd(lhs_sin, rhs_sin),
+                _mm256_mul_pd(_mm256_mul_pd(lhs_cos, rhs_cos), cos_delta)
+            );
+            // clamped as in the scalar Distance
+            const __m256d clamped = _mm256_max_pd(
+                _mm256_min_pd(cos_angle, _mm256_set1_pd(1.0)), _mm256_set1_pd(-1.0)
+            );
+            _mm256_storeu_pd(distances + i, _mm256_mul_pd(Acos(clamped), _mm256_set1_pd(EARTH_RADIUS)));
+        }
+    }
+#endif
+
+    void ComputeDistances(const PreparedPoint* lhs, const PreparedPoint* rhs,
+                          double* distances, size_t count) {
+        size_t done = 0;
+#ifdef SPHERE_AVX2_KERNEL
+        static const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        if (has_avx2) {
+            done = count - count % 4;
+            ComputeDistancesAvx2(lhs, rhs, distances, done);
+        }
+#endif
+        for (size_t i = done; i < count; ++i) {
+            distances[i] = Distance(lhs[i], rhs[i]);
+        }
     }
 }
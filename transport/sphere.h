@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <cstddef>
 
 namespace Sphere {
     double ConvertDegreesToRadians(double degrees);
@@ -13,4 +14,38 @@ namespace Sphere {
     };
 
     double Distance(Point lhs, Point rhs);
+
+    // A point in radians with the trigonometry of its latitude computed once,
+    // for the code that measures distances between the same points repeatedly
+    struct PreparedPoint {
+        double latitude = 0;
+        double longitude = 0;
+        double sin_latitude = 0;
+        double cos_latitude = 1;
+
+        static PreparedPoint FromDegrees(Point point);
+    };
+
+    double Distance(const PreparedPoint& lhs, const PreparedPoint& rhs);
+
+    // A point as a unit vector in 3D. The chord between two of them grows
+    // with the great-circle distance, so it orders and bounds candidates
+    // without any trigonometry.
+    struct UnitVector {
+        double x = 0;
+        double y = 0;
+        double z = 0;
+
+        static UnitVector FromPoint(const PreparedPoint& point);
+    };
+
+    double ComputeChord(const UnitVector& lhs, const UnitVector& rhs);
+    // The chord between points this many meters apart
+    double ComputeChord(double distance);
+
+    // distances[i] = Distance(lhs[i], rhs[i]) for every i < count. Uses an
+    // AVX2 kernel when the CPU has one; its results may differ from the
+    // scalar ones in the last few bits.
+    void ComputeDistances(const PreparedPoint* lhs, const PreparedPoint* rhs,
+                          double* distances, size_t count);
 }
@@ -0,0 +1,134 @@
+#include "sphere_kd_tree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+using namespace std;
+
+namespace Sphere {
+
+    double GetCoordinate(const UnitVector& vector, uint8_t axis) {
+        return axis == 0 ? vector.x : axis == 1 ? vector.y : vector.z;
+    }
+
+    KdTree::KdTree(const vector<PreparedPoint>& points) {
+        nodes_.reserve(points.size());
+        for (uint32_t id = 0; id < points.size(); ++id) {
+            nodes_.push_back({UnitVector::FromPoint(points[id]), id, 0});
+        }
+        Build(0, nodes_.size());
+    }
+
+    void KdTree::Build(size_t begin, size_t end) {
+        if (end - begin <= 1) {
+            return;
+        }
+
+        // split along the axis with the widest spread
+        double min_coordinates[3] = {1, 1, 1};
+        double max_coordinates[3] = {-1, -1, -1};
+        for (size_t i = begin; i < end; ++i) {
+            for (uint8_t axis = 0; axis < 3; ++axis) {
+                const double coordinate = GetCoordinate(nodes_[i].position, axis);
+                min_coordinates[axis] = min(min_coordinates[axis], coordinate);
+                max_coordinates[axis] = max(max_coordinates[axis], coordinate);
+            }
+        }
+        uint8_t axis = 0;
+        for (uint8_t other = 1; other < 3; ++other) {
+            if (max_coordinates[other] - min_coordinates[other] > max_coordinates[axis] - min_coordinates[axis]) {
+                axis = other;
+            }
+        }
+
+        const size_t middle = begin + (end - begin) / 2;
+        nth_element(
+            nodes_.begin() + begin, nodes_.begin() + middle, nodes_.begin() + end,
+            [axis](const Node& lhs, const Node& rhs) {
+                return GetCoordinate(lhs.position, axis) < GetCoordinate(rhs.position, axis);
+            }
+        );
+        nodes_[middle].axis = axis;
+        Build(begin, middle);
+        Build(middle + 1, end);
+    }
+
+    Memory::Usage KdTree::GetMemoryUsage() const {
+        return Memory::GetVectorUsage(nodes_);
+    }
+
+    vector<uint32_t> KdTree::FindNearest(const PreparedPoint& point, size_t count) const {
+        // k comes from the request, more than the tree holds buys nothing
+        count = min(count, nodes_.size());
+        Candidates candidates;
+        if (count > 0) {
+            candidates.reserve(count + 1);
+            SearchNearest(0, nodes_.size(), UnitVector::FromPoint(point), count, candidates);
+        }
+        sort_heap(begin(candidates), end(candidates));
+
+        vector<uint32_t> ids;
+        ids.reserve(candidates.size());
+        for (const auto& [chord, id] : candidates) {
+            ids.push_back(id);
+        }
+        return ids;
+    }
+
+    void KdTree::SearchNearest(size_t begin, size_t end, const UnitVector& target,
+                               size_t count, Candidates& candidates) const {
+        if (begin == end) {
+            return;
+        }
+        const size_t middle = begin + (end - begin) / 2;
+        const Node& node = nodes_[middle];
+
+        candidates.emplace_back(ComputeChord(node.position, target), node.id);
+        push_heap(candidates.begin(), candidates.end());
+        if (candidates.size() > count) {
+            pop_heap(candidates.begin(), candidates.end());
+            candidates.pop_back();
+        }
+
+        if (end - begin == 1) {
+            return;
+        }
+        const double offset = GetCoordinate(target, node.axis) - GetCoordinate(node.position, node.axis);
+        const auto [near_begin, near_end, far_begin, far_end] = offset < 0
+            ? tuple{begin, middle, middle + 1, end}
+            : tuple{middle + 1, end, begin, middle};
+        SearchNearest(near_begin, near_end, target, count, candidates);
+        // every point across the split plane is at least |offset| away
+        if (candidates.size() < count || abs(offset) <= candidates.front().first) {
+            SearchNearest(far_begin, far_end, target, count, candidates);
+        }
+    }
+
+    vector<uint32_t> KdTree::FindWithin(const PreparedPoint& point, double chord) const {
+        vector<uint32_t> ids;
+        SearchWithin(0, nodes_.size(), UnitVector::FromPoint(point), chord, ids);
+        return ids;
+    }
+
+    void KdTree::SearchWithin(size_t begin, size_t end, const UnitVector& target,
+                              double chord, vector<uint32_t>& ids) const {
+        if (begin == end) {
+            return;
+        }
+        const size_t middle = begin + (end - begin) / 2;
+        const Node& node = nodes_[middle];
+        if (ComputeChord(node.position, target) <= chord) {
+            ids.push_back(node.id);
+        }
+
+        const double offset = GetCoordinate(target, node.axis) - GetCoordinate(node.position, node.axis);
+        // the lower half is at least offset away, the upper one -offset
+        if (offset <= chord) {
+            SearchWithin(begin, middle, target, chord, ids);
+        }
+        if (-offset <= chord) {
+            SearchWithin(middle + 1, end, target, chord, ids);
+        }
+    }
+}
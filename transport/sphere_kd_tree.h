@@ -0,0 +1,46 @@
+#pragma once
+
+#include "memory_usage.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace Sphere {
+
+    // Static k-d tree over points as unit vectors, searched by chord; ids
+    // are the indices of the points in the input
+    class KdTree {
+    public:
+        KdTree() = default;
+        explicit KdTree(const std::vector<PreparedPoint>& points);
+
+        // The count points nearest to point, nearest first
+        std::vector<uint32_t> FindNearest(const PreparedPoint& point, size_t count) const;
+        // Every point with a chord to point of at most chord, in no order
+        std::vector<uint32_t> FindWithin(const PreparedPoint& point, double chord) const;
+
+        Memory::Usage GetMemoryUsage() const;
+
+    private:
+        struct Node {
+            UnitVector position;
+            uint32_t id;
+            uint8_t axis;
+        };
+
+        // The root of a range of nodes_ is its middle, the halves are its
+        // subtrees
+        void Build(size_t begin, size_t end);
+
+        // Max-heap of the nearest (chord, id) pairs found so far
+        using Candidates = std::vector<std::pair<double, uint32_t>>;
+        void SearchNearest(size_t begin, size_t end, const UnitVector& target,
+                           size_t count, Candidates& candidates) const;
+        void SearchWithin(size_t begin, size_t end, const UnitVector& target,
+                          double chord, std::vector<uint32_t>& ids) const;
+
+        std::vector<Node> nodes_;
+    };
+}
@@ -0,0 +1,40 @@
+#include "string_pool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+string_view StringPool::Intern(string_view str) {
+    if (auto it = strings_.find(str); it != strings_.end()) {
+        return *it;
+    }
+    char* data = Allocate(str.size());
+    copy(begin(str), end(str), data);
+    return *strings_.insert(string_view(data, str.size())).first;
+}
+
+size_t StringPool::GetSize() const {
+    return strings_.size();
+}
+
+Memory::Usage StringPool::GetMemoryUsage() const {
+    return Memory::Usage{block_bytes_, blocks_.size()}
+        + Memory::GetVectorUsage(blocks_)
+        + Memory::GetHashTableUsage(strings_);
+}
+
+char* StringPool::Allocate(size_t size) {
+    if (size > BLOCK_SIZE / 4) {
+        // long strings get a block of their own, the current one stays open
+        block_bytes_ += size;
+        return blocks_.emplace_back(make_unique<char[]>(size)).get();
+    }
+    if (size > block_free_) {
+        current_block_ = blocks_.emplace_back(make_unique<char[]>(BLOCK_SIZE)).get();
+        block_free_ = BLOCK_SIZE;
+        block_bytes_ += BLOCK_SIZE;
+    }
+    char* data = current_block_ + (BLOCK_SIZE - block_free_);
+    block_free_ -= size;
+    return data;
+}
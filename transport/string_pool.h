@@ -0,0 +1,30 @@
+#pragma once
+
+#include "memory_usage.h"
+
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Keeps a single copy of every distinct string. The returned views stay
+// valid for the pool's lifetime, moves included, so they can be used as
+// keys and names everywhere instead of owning std::string copies.
+class StringPool {
+public:
+    std::string_view Intern(std::string_view str);
+
+    size_t GetSize() const;
+    Memory::Usage GetMemoryUsage() const;
+
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    char* Allocate(size_t size);
+
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* current_block_ = nullptr;
+    size_t block_free_ = 0;
+    size_t block_bytes_ = 0;
+    std::unordered_set<std::string_view> strings_;
+};
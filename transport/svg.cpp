@@ -1,7 +1,20 @@
 #include "svg.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iterator>
+#include <mutex>
+#include <sstream>
 using namespace std;
 
 namespace Svg {
+    string_view InternStyle(string_view value) {
+        static mutex pool_mutex;
+        static StringPool pool;
+        lock_guard lock(pool_mutex);
+        return pool.Intern(value);
+    }
+
     string_view ReadToken(string_view& str, string_view delimeter) {
         size_t pos = str.find(delimeter);
         auto token = Strip(str.substr(0, pos));
@@ -64,7 +77,7 @@ namespace Svg {
             } else if (attr == "font-size") {
                 font_size_ = static_cast<uint32_t>(ParseDouble(value));
             } else if (attr == "font-family") {
-                font_family_ = value;
+                font_family_ = InternStyle(value);
             } else {
                 SetProp(attr, value);
             }
@@ -77,12 +90,12 @@ namespace Svg {
         while (!svg.empty()) {
             auto type = ReadToken(svg, " ");
             if (type == "<polyline") {
-                objects_.push_back(make_unique<Polyline>(ReadToken(svg, "/>")));
+                objects_.emplace_back(in_place_type<Polyline>, ReadToken(svg, "/>"));
             } else if (type == "<circle") {
-                objects_.push_back(make_unique<Circle>(ReadToken(svg, "/>")));
+                objects_.emplace_back(in_place_type<Circle>, ReadToken(svg, "/>"));
             } else if (type == "<text") {
                 auto props = ReadToken(svg, ">");
-                objects_.push_back(make_unique<Text>(props, ReadToken(svg, "</text>")));
+                objects_.emplace_back(in_place_type<Text>, props, ReadToken(svg, "</text>"));
             }
         }  
     }
@@ -172,6 +185,11 @@ namespace Svg {
             color);
     }
 
+    Memory::Usage GetColorMemoryUsage(const Color& color) {
+        const auto* name = get_if<string>(&color);
+        return name ? Memory::GetStringUsage(*name) : Memory::Usage{};
+    }
+
     Circle& Circle::SetCenter(Point point) {
         center_ = point;
         return *this;
@@ -181,21 +199,39 @@ namespace Svg {
         return *this;
     }
 
-    void Circle::Render(ostream& out) const {
+    void RenderClass(ostream& out, string_view style_class) {
+        out << "class=\"" << style_class << "\" ";
+    }
+
+    void Circle::RenderGeometry(ostream& out) const {
         out << "<circle ";
         out << "cx=\"" << center_.x << "\" ";
         out << "cy=\"" << center_.y << "\" ";
         out << "r=\"" << radius_ << "\" ";
+    }
+
+    void Circle::Render(ostream& out) const {
+        RenderGeometry(out);
         PathProps::RenderAttrs(out);
         out << "/>";
     }
 
+    void Circle::Render(ostream& out, string_view style_class) const {
+        RenderGeometry(out);
+        RenderClass(out, style_class);
+        out << "/>";
+    }
+
+    Memory::Usage Circle::GetMemoryUsage() const {
+        return GetPropsMemoryUsage();
+    }
+
     Polyline& Polyline::AddPoint(Point point) {
         points_.push_back(point);
         return *this;
     }
 
-    void Polyline::Render(ostream& out) const {
+    void Polyline::RenderGeometry(ostream& out) const {
         out << "<polyline ";
         out << "points=\"";
         bool first = true;
@@ -208,10 +244,24 @@ namespace Svg {
             out << point.x << "," << point.y;
         }
         out << "\" ";
+    }
+
+    void Polyline::Render(ostream& out) const {
+        RenderGeometry(out);
         PathProps::RenderAttrs(out);
         out << "/>";
     }
 
+    void Polyline::Render(ostream& out, string_view style_class) const {
+        RenderGeometry(out);
+        RenderClass(out, style_class);
+        out << "/>";
+    }
+
+    Memory::Usage Polyline::GetMemoryUsage() const {
+        return GetPropsMemoryUsage() + Memory::GetVectorUsage(points_);
+    }
+
     Text& Text::SetPoint(Point point) {
         point_ = point;
         return *this;
@@ -227,27 +277,30 @@ namespace Svg {
         return *this;
     }
 
-    Text& Text::SetFontFamily(const string& value) {
-        font_family_ = value;
+    Text& Text::SetFontFamily(StyleValue value) {
+        font_family_ = value.Get();
         return *this;
     }
 
-    Text& Text::SetData(const string& data) {
+    Text& Text::SetData(string_view data) {
         data_ = data;
         return *this;
     }
 
-    Text& Text::SetFontWeight(const string& font_weight) {
-        font_weight_ = font_weight;
+    Text& Text::SetFontWeight(StyleValue value) {
+        font_weight_ = value.Get();
         return *this;
     }
 
-    void Text::Render(ostream& out) const {
+    void Text::RenderGeometry(ostream& out) const {
         out << "<text ";
         out << "x=\"" << point_.x << "\" ";
         out << "y=\"" << point_.y << "\" ";
         out << "dx=\"" << offset_.x << "\" ";
         out << "dy=\"" << offset_.y << "\" ";
+    }
+
+    void Text::RenderFontAttrs(ostream& out) const {
         out << "font-size=\"" << font_size_ << "\" ";
         if (font_family_) {
             out << "font-family=\"" << *font_family_ << "\" ";
@@ -255,21 +308,188 @@ namespace Svg {
         if (font_weight_) {
             out << "font-weight=\"" << *font_weight_ << "\" ";
         }
+    }
+
+    void Text::Render(ostream& out) const {
+        RenderGeometry(out);
+        RenderFontAttrs(out);
         PathProps::RenderAttrs(out);
         out << ">";
         out << data_;
         out << "</text>";
     }
 
+    void Text::Render(ostream& out, string_view style_class) const {
+        RenderGeometry(out);
+        RenderClass(out, style_class);
+        out << ">";
+        out << data_;
+        out << "</text>";
+    }
+
+    void Text::RenderStyle(ostream& out) const {
+        out << "font-size:" << font_size_ << "px;";
+        if (font_family_) {
+            out << "font-family:" << *font_family_ << ";";
+        }
+        if (font_weight_) {
+            out << "font-weight:" << *font_weight_ << ";";
+        }
+        PathProps::RenderStyle(out);
+    }
+
+    Memory::Usage Text::GetMemoryUsage() const {
+        // the font family and weight are interned, shared by every text
+        return GetPropsMemoryUsage() + Memory::GetStringUsage(data_);
+    }
+
+    void Document::Append(Document other) {
+        if (style_mode_ == StyleMode::Classes) {
+            if (other.style_mode_ == StyleMode::Classes) {
+                // renumber other's classes; they are in order of first use
+                // there, so the result is the same as adding one by one
+                vector<uint32_t> class_ids;
+                class_ids.reserve(other.class_styles_.size());
+                for (string& style : other.class_styles_) {
+                    class_ids.push_back(InternClass(move(style)));
+                }
+                for (const uint32_t class_id : other.object_classes_) {
+                    object_classes_.push_back(class_ids[class_id]);
+                }
+            } else {
+                for (const auto& object : other.objects_) {
+                    AssignClass(object);
+                }
+            }
+        }
+        objects_.insert(
+            end(objects_),
+            make_move_iterator(begin(other.objects_)),
+            make_move_iterator(end(other.objects_))
+        );
+    }
+
+    void Document::SetStyleMode(StyleMode mode) {
+        style_mode_ = mode;
+        class_ids_.clear();
+        class_styles_.clear();
+        object_classes_.clear();
+        if (style_mode_ == StyleMode::Classes) {
+            for (const auto& object : objects_) {
+                AssignClass(object);
+            }
+        }
+    }
+
+    void Document::SetViewBox(Rect view_box) {
+        view_box_ = view_box;
+    }
+
+    size_t Document::GetObjectCount() const {
+        return objects_.size();
+    }
+
+    Memory::Usage Document::GetMemoryUsage() const {
+        Memory::Usage usage = Memory::GetVectorUsage(objects_)
+            + Memory::GetHashTableUsage(class_ids_)
+            + Memory::GetVectorUsage(class_styles_)
+            + Memory::GetVectorUsage(object_classes_);
+        for (const Object& object : objects_) {
+            usage += visit([](const auto& object) { return object.GetMemoryUsage(); }, object);
+        }
+        for (const auto& [style, class_id] : class_ids_) {
+            usage += Memory::GetStringUsage(style);
+        }
+        for (const string& style : class_styles_) {
+            usage += Memory::GetStringUsage(style);
+        }
+        return usage;
+    }
+
+    void Document::AssignClass(const Object& object) {
+        thread_local ostringstream style;
+        style.str({});
+        visit([](const auto& object) { object.RenderStyle(style); }, object);
+        object_classes_.push_back(InternClass(style.str()));
+    }
+
+    uint32_t Document::InternClass(string style) {
+        const auto [it, inserted] = class_ids_.emplace(style, class_styles_.size());
+        if (inserted) {
+            class_styles_.push_back(move(style));
+        }
+        return it->second;
+    }
+
     void Document::Render(ostream& out) const {
+        RenderHeader(out);
+        RenderObjects(out, 0, objects_.size());
+        RenderFooter(out);
+    }
+
+    void Document::RenderHeader(ostream& out) const {
         out << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>";
-        out << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">";
-        for (const auto& object_ptr : objects_) {
-            object_ptr->Render(out);
+        out << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\"";
+        if (view_box_) {
+            out << " viewBox=\"" << view_box_->min.x << " " << view_box_->min.y << " "
+                << view_box_->max.x - view_box_->min.x << " " << view_box_->max.y - view_box_->min.y << "\"";
+        }
+        out << ">";
+        if (style_mode_ == StyleMode::Classes) {
+            out << "<style>";
+            const string prefix = GetClassPrefix();
+            for (size_t class_id = 0; class_id < class_styles_.size(); ++class_id) {
+                out << "." << prefix << class_id << "{" << class_styles_[class_id] << "}";
+            }
+            out << "</style>";
+        }
+    }
+
+    void Document::RenderObjects(ostream& out, size_t begin, size_t end) const {
+        const string prefix = style_mode_ == StyleMode::Classes ? GetClassPrefix() : string();
+        for (size_t i = begin; i < end; ++i) {
+            if (style_mode_ == StyleMode::Classes) {
+                const string style_class = prefix + to_string(object_classes_[i]);
+                visit([&out, &style_class](const auto& object) { object.Render(out, style_class); }, objects_[i]);
+            } else {
+                visit([&out](const auto& object) { object.Render(out); }, objects_[i]);
+            }
+        }
+    }
+
+    string Document::GetClassPrefix() const {
+        // FNV-1a, which unlike std::hash gives the same names everywhere
+        uint32_t digest = 2166136261u;
+        const auto add = [&digest](char c) {
+            digest = (digest ^ static_cast<unsigned char>(c)) * 16777619u;
+        };
+        for (const string& style : class_styles_) {
+            for (const char c : style) {
+                add(c);
+            }
+            add('}');
         }
+        ostringstream prefix;
+        prefix << 's' << hex << setw(8) << setfill('0') << digest << '-';
+        return prefix.str();
+    }
+
+    void Document::RenderFooter(ostream& out) const {
         out << "</svg>";
     }
 
+    bool Intersects(const Rect& lhs, const Rect& rhs) {
+        return lhs.min.x <= rhs.max.x && rhs.min.x <= lhs.max.x
+            && lhs.min.y <= rhs.max.y && rhs.min.y <= lhs.max.y;
+    }
+
+    Rect Union(const Rect& lhs, const Rect& rhs) {
+        return {
+            {min(lhs.min.x, rhs.min.x), min(lhs.min.y, rhs.min.y)},
+            {max(lhs.max.x, rhs.max.x), max(lhs.max.y, rhs.max.y)},
+        };
+    }
+
     bool operator==(Point lhs, Point rhs) {
         return EqualWithAccuracy(lhs.x, rhs.x) && EqualWithAccuracy(lhs.y, rhs.y);
     }
@@ -301,17 +521,7 @@ namespace Svg {
     }
 
     bool operator==(const Document& lhs, const Document& rhs) {
-        if (lhs.objects_.size() != rhs.objects_.size()) {
-            return false;
-        }
-
-        for (size_t i = 0; i < lhs.objects_.size(); ++i) {
-            if (!lhs.objects_[i]->EqualTo(*rhs.objects_[i])) {
-                return false;
-            }
-        }
-
-        return true;
+        return lhs.objects_ == rhs.objects_;
     }
 
     std::ostream& operator<<(std::ostream& out, const Polyline& obj) {
@@ -333,28 +543,4 @@ namespace Svg {
         doc.Render(out);
         return out;
     }
-
-    bool Polyline::EqualTo(const Object& other) const {
-        if (const Polyline* p = dynamic_cast<const Polyline*>(&other)) {
-            return *this == *p;
-        } else {
-            return false;
-        }
-    }
-
-    bool Circle::EqualTo(const Object& other) const {
-        if (const Circle* p = dynamic_cast<const Circle*>(&other)) {
-            return *this == *p;
-        } else {
-            return false;
-        }
-    }
-
-    bool Text::EqualTo(const Object& other) const {
-        if (const Text* p = dynamic_cast<const Text*>(&other)) {
-            return *this == *p;
-        } else {
-            return false;
-        }
-    }
 }
\ No newline at end of file
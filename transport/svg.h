@@ -1,4 +1,6 @@
 #pragma once
+#include "memory_usage.h"
+#include "string_pool.h"
 #include "utils.h"
 
 #include <iostream>
@@ -9,6 +11,7 @@
 #include <vector>
 #include <memory>
 #include <string_view>
+#include <unordered_map>
 
 namespace Svg {
 
@@ -17,6 +20,14 @@ namespace Svg {
         double y = 0;
     };
 
+    struct Rect {
+        Point min;
+        Point max;
+    };
+
+    bool Intersects(const Rect& lhs, const Rect& rhs);
+    Rect Union(const Rect& lhs, const Rect& rhs);
+
     struct Rgb {
         uint8_t red;
         uint8_t green;
@@ -35,12 +46,40 @@ namespace Svg {
     void RenderColor(std::ostream&, Rgb);
     void RenderColor(std::ostream&, Rgba);
     void RenderColor(std::ostream&, const Color&);
+    Memory::Usage GetColorMemoryUsage(const Color&);
 
-    class Object {
+    // Style keywords and font names repeat on every object, so objects keep
+    // views instead of strings of their own. InternStyle keeps one shared
+    // copy of each value under a lock.
+    std::string_view InternStyle(std::string_view value);
+
+    // A style value whose storage outlives every object: a string literal,
+    // taken as is so that the setters need no lock, or a value interned
+    // through InternStyle. Other strings do not convert.
+    class StyleValue {
     public:
-        virtual void Render(std::ostream& out) const = 0;
-        virtual bool EqualTo(const Object&) const = 0;
-        virtual ~Object() = default;
+        template <size_t N>
+        consteval StyleValue(const char (&literal)[N]) : value_(literal, N - 1) {}
+
+        static StyleValue Intern(std::string_view value) {
+            return StyleValue(InternStyle(value));
+        }
+
+        std::string_view Get() const {
+            return value_;
+        }
+
+    private:
+        explicit StyleValue(std::string_view value) : value_(value) {}
+
+        std::string_view value_;
+    };
+
+    // How a document writes presentation attributes: on every object, or
+    // once per distinct set as generated CSS classes in a <style> block
+    enum class StyleMode {
+        Inline,
+        Classes,
     };
 
     template <typename Owner>
@@ -49,24 +88,27 @@ namespace Svg {
         Owner& SetFillColor(const Color& color);
         Owner& SetStrokeColor(const Color& color);
         Owner& SetStrokeWidth(double value);
-        Owner& SetStrokeLineCap(std::string_view);
-        Owner& SetStrokeLineJoin(std::string_view);
+        Owner& SetStrokeLineCap(StyleValue value);
+        Owner& SetStrokeLineJoin(StyleValue value);
         void RenderAttrs(std::ostream& out) const;
+        // The same properties as CSS declarations
+        void RenderStyle(std::ostream& out) const;
         void SetProp(std::string_view, std::string_view);
     protected:
         bool EqualProps(const PathProps<Owner>&) const;
+        Memory::Usage GetPropsMemoryUsage() const;
     private:
         Color fill_color_;
         Color stroke_color_;
         double stroke_width_ = 1.0;
-        std::optional<std::string> stroke_line_cap_;
-        std::optional<std::string> stroke_line_join_;
+        std::optional<std::string_view> stroke_line_cap_;
+        std::optional<std::string_view> stroke_line_join_;
     
     private:
         Owner& AsOwner();
     };
 
-    class Circle : public Object, public PathProps<Circle> {
+    class Circle : public PathProps<Circle> {
     public:
         friend bool operator==(const Circle&, const Circle&);
 
@@ -75,14 +117,18 @@ namespace Svg {
 
         Circle& SetCenter(Point point);
         Circle& SetRadius(double radius);
-        void Render(std::ostream& out) const override;
-        bool EqualTo(const Object&) const override;
+        void Render(std::ostream& out) const;
+        void Render(std::ostream& out, std::string_view style_class) const;
+        // Heap memory held, as for every object type
+        Memory::Usage GetMemoryUsage() const;
     private:
+        void RenderGeometry(std::ostream& out) const;
+
         Point center_;
         double radius_ = 1;
     };
 
-    class Polyline : public Object, public PathProps<Polyline> {
+    class Polyline : public PathProps<Polyline> {
     public:
         friend bool operator==(const Polyline&, const Polyline&);
 
@@ -90,13 +136,16 @@ namespace Svg {
         Polyline(std::string_view);
 
         Polyline& AddPoint(Point point);
-        void Render(std::ostream& out) const override;
-        bool EqualTo(const Object&) const override;
+        void Render(std::ostream& out) const;
+        void Render(std::ostream& out, std::string_view style_class) const;
+        Memory::Usage GetMemoryUsage() const;
     private:
+        void RenderGeometry(std::ostream& out) const;
+
         std::vector<Point> points_;
     };
 
-    class Text : public Object, public PathProps<Text> {
+    class Text : public PathProps<Text> {
     public:
         friend bool operator==(const Text&, const Text&);
 
@@ -105,18 +154,23 @@ namespace Svg {
         Text& SetPoint(Point point);
         Text& SetOffset(Point point);
         Text& SetFontSize(uint32_t size);
-        Text& SetFontFamily(const std::string& value);
-        Text& SetData(const std::string& data);
-        Text& SetFontWeight(const std::string&);
-        void Render(std::ostream& out) const override;
-        bool EqualTo(const Object&) const override;
+        Text& SetFontFamily(StyleValue value);
+        Text& SetData(std::string_view data);
+        Text& SetFontWeight(StyleValue value);
+        void Render(std::ostream& out) const;
+        void Render(std::ostream& out, std::string_view style_class) const;
+        void RenderStyle(std::ostream& out) const;
+        Memory::Usage GetMemoryUsage() const;
     private:
+        void RenderGeometry(std::ostream& out) const;
+        void RenderFontAttrs(std::ostream& out) const;
+
         Point point_;
         Point offset_;
         uint32_t font_size_ = 1;
-        std::optional<std::string> font_family_;
+        std::optional<std::string_view> font_family_;
         std::string data_;
-        std::optional<std::string> font_weight_;
+        std::optional<std::string_view> font_weight_;
     };
 
     Point ParsePoint(std::string_view);
@@ -132,10 +186,40 @@ namespace Svg {
         Document(std::string_view);
         template <typename ObjectType>
         void Add(ObjectType object);
+        // Moves the objects of other to the end, as if they were added here
+        void Append(Document other);
+
+        void SetStyleMode(StyleMode mode);
+        // The region of user space shown, written as the viewBox attribute
+        void SetViewBox(Rect view_box);
+        size_t GetObjectCount() const;
+        Memory::Usage GetMemoryUsage() const;
 
         void Render(std::ostream& out) const;
+        // Render is RenderHeader, RenderObjects over all objects and
+        // RenderFooter, so consecutive ranges of objects can be serialized
+        // concurrently and concatenated in order
+        void RenderHeader(std::ostream& out) const;
+        void RenderObjects(std::ostream& out, size_t begin, size_t end) const;
+        void RenderFooter(std::ostream& out) const;
     private:
-        std::vector<std::unique_ptr<Object>> objects_;
+        // Objects are stored inline, in drawing order
+        using Object = std::variant<Circle, Polyline, Text>;
+
+        void AssignClass(const Object& object);
+        uint32_t InternClass(std::string style);
+        // Class names start with a digest of the whole style table, so two
+        // documents on one page share a class name only if they define it alike
+        std::string GetClassPrefix() const;
+
+        StyleMode style_mode_ = StyleMode::Inline;
+        std::optional<Rect> view_box_;
+        std::vector<Object> objects_;
+        // With StyleMode::Classes, classes are numbered in order of first use
+        // as objects are added
+        std::unordered_map<std::string, uint32_t> class_ids_;
+        std::vector<std::string> class_styles_;
+        std::vector<uint32_t> object_classes_;
     };
 
     template <typename Owner>
@@ -162,14 +246,14 @@ namespace Svg {
     }
 
     template <typename Owner>
-    Owner& PathProps<Owner>::SetStrokeLineCap(std::string_view value) {
-        stroke_line_cap_ = value;
+    Owner& PathProps<Owner>::SetStrokeLineCap(StyleValue value) {
+        stroke_line_cap_ = value.Get();
         return AsOwner();
     }
 
     template <typename Owner>
-    Owner& PathProps<Owner>::SetStrokeLineJoin(std::string_view value) {
-        stroke_line_join_ = value;
+    Owner& PathProps<Owner>::SetStrokeLineJoin(StyleValue value) {
+        stroke_line_join_ = value.Get();
         return AsOwner();
     }
 
@@ -190,6 +274,21 @@ namespace Svg {
         }
     }
 
+    template <typename Owner>
+    void PathProps<Owner>::RenderStyle(std::ostream& out) const {
+        out << "fill:";
+        RenderColor(out, fill_color_);
+        out << ";stroke:";
+        RenderColor(out, stroke_color_);
+        out << ";stroke-width:" << stroke_width_ << "px;";
+        if (stroke_line_cap_) {
+            out << "stroke-linecap:" << *stroke_line_cap_ << ";";
+        }
+        if (stroke_line_join_) {
+            out << "stroke-linejoin:" << *stroke_line_join_ << ";";
+        }
+    }
+
     template <typename Owner>
     void PathProps<Owner>::SetProp(std::string_view name, std::string_view value) {
         if (name == "fill") {
@@ -199,12 +298,17 @@ namespace Svg {
         } else if (name == "stroke-width") {
             SetStrokeWidth(ParseDouble(value));
         } else if (name == "stroke-linecap") {
-            SetStrokeLineCap(value);
+            SetStrokeLineCap(StyleValue::Intern(value));
         } else if (name == "stroke-linejoin") {
-            SetStrokeLineJoin(value);
+            SetStrokeLineJoin(StyleValue::Intern(value));
         }
     }
 
+    template <typename Owner>
+    Memory::Usage PathProps<Owner>::GetPropsMemoryUsage() const {
+        return GetColorMemoryUsage(fill_color_) + GetColorMemoryUsage(stroke_color_);
+    }
+
     template <typename Owner>
     bool PathProps<Owner>::EqualProps(const PathProps<Owner>& other) const {
         if (!(fill_color_ == other.fill_color_)) {
@@ -232,7 +336,10 @@ namespace Svg {
 
     template <typename ObjectType>
     void Document::Add(ObjectType object) {
-        objects_.push_back(std::make_unique<ObjectType>(std::move(object)));
+        objects_.emplace_back(std::in_place_type<ObjectType>, std::move(object));
+        if (style_mode_ == StyleMode::Classes) {
+            AssignClass(objects_.back());
+        }
     }
 
     bool operator==(Point lhs, Point rhs);
@@ -0,0 +1,56 @@
+// Builds a catalog of a generated city and checks the memory report: the
+// index the map renderer keeps for tiles must stay within a small multiple
+// of the map document it serves. Exits with 1 if it does not.
+
+#include "bench/city_generator.h"
+#include "descriptions.h"
+#include "transport_catalog.h"
+
+#include <iostream>
+#include <string_view>
+
+using namespace std;
+
+// The renderer also holds the stop coordinates and the bus lines, so it is
+// allowed somewhat more than the document itself
+static constexpr double MAX_RENDERER_TO_DOCUMENT_RATIO = 4.0;
+
+size_t GetComponentBytes(const Memory::Report& report, string_view name) {
+    for (const auto& [component, usage] : report) {
+        if (component == name) {
+            return usage.bytes;
+        }
+    }
+    return 0;
+}
+
+int main() {
+    const Json::Dict city = Bench::GenerateCity({
+        .stop_count = 20000,
+        .bus_count = 2000,
+        .route_length = 12,
+        .roundtrip_ratio = 0.5,
+        .distance_density = 1.0,
+        .request_count = 0,
+        .seed = 1,
+    });
+    Json::Dict routing_settings = city.at("routing_settings").AsMap();
+    routing_settings.emplace("router_engine", Json::Node("dijkstra"s));
+    const TransportCatalog catalog(
+        Descriptions::ReadDescriptions(city.at("base_requests").AsArray()),
+        routing_settings,
+        city.at("render_settings").AsMap(),
+        {}
+    );
+
+    const Memory::Report report = catalog.GetMemoryReport();
+    const size_t renderer_bytes = GetComponentBytes(report, "map renderer");
+    const size_t document_bytes = GetComponentBytes(report, "map document");
+    cout << "map renderer: " << renderer_bytes << " bytes, map document: " << document_bytes << " bytes" << endl;
+    if (document_bytes == 0 || renderer_bytes > MAX_RENDERER_TO_DOCUMENT_RATIO * document_bytes) {
+        cerr << "the map renderer takes over " << MAX_RENDERER_TO_DOCUMENT_RATIO
+             << " times the memory of the map document" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t thread_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template <typename Task>
+    auto Submit(Task task) -> std::future<std::invoke_result_t<Task>>;
+
+    size_t GetThreadCount() const;
+
+private:
+    void Run();
+
+    std::mutex mutex_;
+    std::condition_variable has_tasks_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+
+
+template <typename Task>
+auto ThreadPool::Submit(Task task) -> std::future<std::invoke_result_t<Task>> {
+    using Result = std::invoke_result_t<Task>;
+    // std::function needs a copyable target, so the packaged task is shared
+    auto packaged_task = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+    auto result = packaged_task->get_future();
+    {
+        std::lock_guard lock(mutex_);
+        tasks_.push_back([packaged_task] { (*packaged_task)(); });
+    }
+    has_tasks_.notify_one();
+    return result;
+}
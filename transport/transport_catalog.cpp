@@ -1,91 +1,499 @@
 #include "transport_catalog.h"
+#include "metrics.h"
+#include "profile.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <future>
+#include <iterator>
 #include <sstream>
+#include <thread>
+#include <tuple>
 using namespace std;
 
+namespace Responses {
+    Json::Dict ToJson(const Stop& stop) {
+        vector<Json::Node> bus_nodes;
+        bus_nodes.reserve(stop.bus_names.size());
+        for (const auto& bus_name : stop.bus_names) {
+            bus_nodes.emplace_back(string(bus_name));
+        }
+        return {{"buses", Json::Node(move(bus_nodes))}};
+    }
+
+    Json::Dict ToJson(const Bus& bus) {
+        return {
+            {"stop_count", Json::Node(static_cast<int>(bus.stop_count))},
+            {"unique_stop_count", Json::Node(static_cast<int>(bus.unique_stop_count))},
+            {"route_length", Json::Node(bus.road_route_length)},
+            {"curvature", Json::Node(bus.road_route_length / bus.geo_route_length)},
+        };
+    }
+
+    Json::Node Serialized::Splice(int request_id) const {
+        const string id = to_string(request_id);
+        string text;
+        text.reserve(head.size() + id.size() + tail.size());
+        text.append(head).append(id).append(tail);
+        return Json::Raw{{make_shared<const string>(move(text))}};
+    }
+}
+
 TransportCatalog::TransportCatalog(std::vector<Descriptions::InputQuery> data,
                                    const Json::Dict& routing_settings_json,
-                                   const Json::Dict& render_settings_json)
+                                   const Json::Dict& render_settings_json,
+                                   const Options& options)
+    : network_(data),
+      descriptions_usage_(Descriptions::GetMemoryUsage(data))
 {
-    auto stops_end = partition(begin(data), end(data), [](const auto& item) {
-        return holds_alternative<Descriptions::Stop>(item);
-        });
-
-    Descriptions::StopsDict stops_dict;
-    for (const auto& item : Range{begin(data), stops_end}) {
-        const auto& stop = get<Descriptions::Stop>(item);
-        stops_dict[stop.name] = &stop;
-        stops_.insert({stop.name, {}});
-    }
-
-    Descriptions::BusesDict buses_dict;
-    for (const auto& item : Range{stops_end, end(data)}) {
-        const auto& bus = get<Descriptions::Bus>(item);
-
-        buses_dict[bus.name] = &bus;
-        buses_[bus.name] = Bus{
-          bus.stops.size(),
-          ComputeUniqueItemsCount(AsRange(bus.stops)),
-          ComputeRoadRouteLength(bus.stops, stops_dict),
-          ComputeGeoRouteDistance(bus.stops, stops_dict)
-        };
+    data.clear();
+
+    // Once network_ is built, the router, the map, the stop responses and
+    // every bus response depend on it alone and are computed concurrently
+    ThreadPool pool(thread::hardware_concurrency());
+
+    auto router_task = pool.Submit([this, &routing_settings_json] {
+        return make_unique<TransportRouter>(network_, routing_settings_json);
+    });
+    auto stops_task = pool.Submit([this] {
+        LOG_DURATION("stop bus lists");
+        ComputeStopsBusNames();
+    });
+    auto stops_tree_task = pool.Submit([this] {
+        LOG_DURATION("stop k-d tree");
+        vector<Sphere::PreparedPoint> positions;
+        positions.reserve(network_.GetStops().size());
+        for (const auto& stop : network_.GetStops()) {
+            positions.push_back(stop.prepared_position);
+        }
+        stops_tree_ = Sphere::KdTree(positions);
+    });
+
+    const auto& buses = network_.GetBuses();
+    buses_.resize(buses.size());
+    const size_t chunk_size = max<size_t>(1, buses.size() / (pool.GetThreadCount() * 4));
+    vector<future<void>> bus_tasks;
+    for (size_t chunk_begin = 0; chunk_begin < buses.size(); chunk_begin += chunk_size) {
+        const size_t chunk_end = min(buses.size(), chunk_begin + chunk_size);
+        bus_tasks.push_back(pool.Submit([this, &buses, chunk_begin, chunk_end] {
+            LOG_DURATION("bus stats");
+            for (size_t bus_id = chunk_begin; bus_id < chunk_end; ++bus_id) {
+                buses_[bus_id] = ComputeBusStats(buses[bus_id]);
+            }
+        }));
+    }
+
+    // the renderer spreads its layers over the pool and waits for them, so
+    // it runs here rather than as a task of the same pool
+    if (!network_.GetStops().empty()) {
+        LOG_DURATION("map build");
+        renderer_ = make_unique<MapRenderer>(network_, render_settings_json);
+        map_ = renderer_->Render(pool);
+    }
+
+    for (auto& task : bus_tasks) {
+        task.get();
+    }
+    stops_task.get();
+    stops_tree_task.get();
+    if (options.prebuilt_responses) {
+        LOG_DURATION("serialize responses");
+        SerializeResponses();
+    }
+    router_ = router_task.get();
+    if (routing_settings_json.count("request_timeout_ms") > 0) {
+        request_timeout_ = Deadline::FromMilliseconds(routing_settings_json.at("request_timeout_ms").AsDouble());
+    }
+    if (options.route_cache_bytes > 0) {
+        route_cache_ = make_unique<RouteCache>(options.route_cache_bytes);
+    }
+}
+
+TransportCatalog::Bus TransportCatalog::ComputeBusStats(const Network::Bus& bus) const {
+    return Bus{
+        bus.stops.size(),
+        ComputeUniqueItemsCount(AsRange(bus.stops)),
+        bus.cumulative_distances.empty() ? 0 : bus.cumulative_distances.back(),
+        ComputeGeoRouteDistance(bus.stops)
+    };
+}
 
-        for (const string& stop_name : bus.stops) {
-            stops_.at(stop_name).bus_names.insert(bus.name);
+void TransportCatalog::ComputeStopsBusNames() {
+    stops_.resize(network_.GetStops().size());
+    // buses come in name order, so every bus_names list stays sorted
+    for (const auto& bus : network_.GetBuses()) {
+        for (const Network::StopId stop_id : bus.stops) {
+            auto& bus_names = stops_[stop_id].bus_names;
+            if (bus_names.empty() || bus_names.back() != bus.name) {
+                bus_names.push_back(bus.name);
+            }
         }
     }
+}
 
-    router_ = make_unique<TransportRouter>(stops_dict, buses_dict, routing_settings_json);
-    map_ = BuildMap(stops_dict, buses_dict, render_settings_json);
+const TransportCatalog::Stop* TransportCatalog::GetStop(string_view name) const {
+    TRACE_SPAN("name lookup");
+    const auto id = network_.FindStop(name);
+    return id ? &stops_[*id] : nullptr;
 }
 
-const TransportCatalog::Stop* TransportCatalog::GetStop(const string& name) const {
-    return GetValuePointer(stops_, name);
+const TransportCatalog::Bus* TransportCatalog::GetBus(string_view name) const {
+    TRACE_SPAN("name lookup");
+    const auto id = network_.FindBus(name);
+    return id ? &buses_[*id] : nullptr;
 }
 
-const TransportCatalog::Bus* TransportCatalog::GetBus(const string& name) const {
-    return GetValuePointer(buses_, name);
+const Responses::Serialized* TransportCatalog::GetSerializedStop(string_view name) const {
+    const auto id = network_.FindStop(name);
+    return id && *id < serialized_stops_.size() ? &serialized_stops_[*id] : nullptr;
 }
 
-optional<TransportRouter::RouteInfo> TransportCatalog::FindRoute(const string& stop_from, const string& stop_to) const {
-    return router_->FindRoute(stop_from, stop_to);
+const Responses::Serialized* TransportCatalog::GetSerializedBus(string_view name) const {
+    const auto id = network_.FindBus(name);
+    return id && *id < serialized_buses_.size() ? &serialized_buses_[*id] : nullptr;
 }
 
-int TransportCatalog::ComputeRoadRouteLength(
-    const vector<string>& stops,
-    const Descriptions::StopsDict& stops_dict
-) {
-    int result = 0;
-    for (size_t i = 1; i < stops.size(); ++i) {
-        result += Descriptions::ComputeStopsDistance(*stops_dict.at(stops[i - 1]), *stops_dict.at(stops[i]));
+pair<size_t, size_t> Responses::AppendSerialized(const Json::Dict& dict, string& arena) {
+    static const string REQUEST_ID_KEY = "request_id";
+    const auto split = dict.lower_bound(REQUEST_ID_KEY);
+
+    // both halves are printed as dicts with the braces stripped
+    ostringstream before;
+    Json::PrintValue(Json::Dict(begin(dict), split), before);
+    const string head_items = before.str().substr(1, before.str().size() - 2);
+    ostringstream after;
+    Json::PrintValue(Json::Dict(split, end(dict)), after);
+    const string tail_items = after.str().substr(1, after.str().size() - 2);
+
+    const size_t head_begin = arena.size();
+    arena += '{';
+    arena += head_items;
+    if (!head_items.empty()) {
+        arena += ", ";
     }
-    return result;
+    arena += '"' + REQUEST_ID_KEY + "\": ";
+    const size_t tail_begin = arena.size();
+    if (!tail_items.empty()) {
+        arena += ", ";
+        arena += tail_items;
+    }
+    arena += '}';
+    return {tail_begin - head_begin, arena.size() - tail_begin};
+}
+
+void TransportCatalog::SerializeResponses() {
+    vector<pair<size_t, size_t>> stop_sizes;
+    stop_sizes.reserve(stops_.size());
+    for (const auto& stop : stops_) {
+        stop_sizes.push_back(Responses::AppendSerialized(Responses::ToJson(stop), serialized_arena_));
+    }
+    vector<pair<size_t, size_t>> bus_sizes;
+    bus_sizes.reserve(buses_.size());
+    for (const auto& bus : buses_) {
+        bus_sizes.push_back(Responses::AppendSerialized(Responses::ToJson(bus), serialized_arena_));
+    }
+
+    // the arena does not grow any more, so views into it are taken now
+    const string_view arena = serialized_arena_;
+    size_t offset = 0;
+    auto take_views = [&arena, &offset](const vector<pair<size_t, size_t>>& sizes) {
+        vector<Responses::Serialized> result;
+        result.reserve(sizes.size());
+        for (const auto& [head_size, tail_size] : sizes) {
+            result.push_back({arena.substr(offset, head_size), arena.substr(offset + head_size, tail_size)});
+            offset += head_size + tail_size;
+        }
+        return result;
+    };
+    serialized_stops_ = take_views(stop_sizes);
+    serialized_buses_ = take_views(bus_sizes);
+}
+
+optional<TransportRouter::RouteInfo> TransportCatalog::FindRoute(string_view stop_from, string_view stop_to) const {
+    optional<Network::StopId> from_id;
+    optional<Network::StopId> to_id;
+    {
+        TRACE_SPAN("name lookup");
+        from_id = network_.FindStop(stop_from);
+        to_id = network_.FindStop(stop_to);
+    }
+    if (!from_id || !to_id) {
+        return nullopt;
+    }
+    return router_->FindRoute(*from_id, *to_id);
+}
+
+optional<Deadline::Clock::duration> TransportCatalog::GetRequestTimeout() const {
+    return request_timeout_;
+}
+
+optional<Network::StopId> TransportCatalog::FindStopId(string_view name) const {
+    TRACE_SPAN("name lookup");
+    return network_.FindStop(name);
+}
+
+RouteCache* TransportCatalog::GetRouteCache() const {
+    return route_cache_.get();
+}
+
+vector<optional<TransportRouter::RouteInfo>> TransportCatalog::FindRoutes(string_view stop_from,
+                                                                          const vector<string_view>& stops_to) const {
+    vector<optional<TransportRouter::RouteInfo>> routes(stops_to.size());
+    optional<Network::StopId> from_id;
+    // the known targets, and where their routes go in routes
+    vector<Network::StopId> to_ids;
+    vector<size_t> positions;
+    {
+        TRACE_SPAN("name lookup");
+        from_id = network_.FindStop(stop_from);
+        for (size_t position = 0; from_id && position < stops_to.size(); ++position) {
+            if (const auto to_id = network_.FindStop(stops_to[position])) {
+                to_ids.push_back(*to_id);
+                positions.push_back(position);
+            }
+        }
+    }
+    if (to_ids.empty()) {
+        return routes;
+    }
+    auto found_routes = router_->FindRoutes(*from_id, to_ids);
+    for (size_t index = 0; index < found_routes.size(); ++index) {
+        routes[positions[index]] = move(found_routes[index]);
+    }
+    return routes;
 }
 
-double TransportCatalog::ComputeGeoRouteDistance(
-    const vector<string>& stops,
-    const Descriptions::StopsDict& stops_dict
-) {
+vector<Responses::NearbyStop> TransportCatalog::FindNearestStops(Sphere::Point point, size_t count) const {
+    const auto prepared_point = Sphere::PreparedPoint::FromDegrees(point);
+    vector<Network::StopId> stop_ids;
+    {
+        TRACE_SPAN("k-d tree search");
+        stop_ids = stops_tree_.FindNearest(prepared_point, count);
+        Profile::TraceCount("candidates", stop_ids.size());
+    }
+    return RankStops(prepared_point, stop_ids);
+}
+
+vector<Responses::NearbyStop> TransportCatalog::FindStopsWithin(Sphere::Point point, double radius) const {
+    // the chord bound is widened a little against rounding, the exact
+    // distance decides
+    static constexpr double CHORD_SLACK = 1e-9;
+
+    const auto prepared_point = Sphere::PreparedPoint::FromDegrees(point);
+    vector<Network::StopId> stop_ids;
+    {
+        TRACE_SPAN("k-d tree search");
+        stop_ids = stops_tree_.FindWithin(prepared_point, Sphere::ComputeChord(radius) + CHORD_SLACK);
+        Profile::TraceCount("candidates", stop_ids.size());
+    }
+    auto stops = RankStops(prepared_point, stop_ids);
+    stops.erase(
+        find_if(begin(stops), end(stops), [radius](const Responses::NearbyStop& stop) {
+            return stop.distance > radius;
+        }),
+        end(stops)
+    );
+    return stops;
+}
+
+vector<Responses::NearbyStop> TransportCatalog::RankStops(const Sphere::PreparedPoint& point,
+                                                          const vector<Network::StopId>& stop_ids) const {
+    TRACE_SPAN("ranking");
+    vector<Responses::NearbyStop> stops;
+    stops.reserve(stop_ids.size());
+    for (const Network::StopId stop_id : stop_ids) {
+        const auto& stop = network_.GetStop(stop_id);
+        stops.push_back({stop.name, Sphere::Distance(point, stop.prepared_position)});
+    }
+    sort(begin(stops), end(stops), [](const Responses::NearbyStop& lhs, const Responses::NearbyStop& rhs) {
+        return tie(lhs.distance, lhs.name) < tie(rhs.distance, rhs.name);
+    });
+    return stops;
+}
+
+double TransportCatalog::ComputeGeoRouteDistance(const vector<Network::StopId>& stops) const {
+    if (stops.size() <= 1) {
+        return 0;
+    }
+    vector<Sphere::PreparedPoint> points;
+    points.reserve(stops.size());
+    for (const Network::StopId stop_id : stops) {
+        points.push_back(network_.GetStop(stop_id).prepared_position);
+    }
+    vector<double> distances(stops.size() - 1);
+    Sphere::ComputeDistances(points.data(), points.data() + 1, distances.data(), distances.size());
+
     double result = 0;
-    for (size_t i = 1; i < stops.size(); ++i) {
-        result += Sphere::Distance(
-            stops_dict.at(stops[i - 1])->position, stops_dict.at(stops[i])->position
-        );
+    for (const double distance : distances) {
+        result += distance;
     }
     return result;
 }
 
-string TransportCatalog::RenderMap() const {
-    ostringstream oss;
-    map_.Render(oss);
-    return oss.str();
+string RenderEscaped(const Svg::Document& svg, size_t begin, size_t end) {
+    ostringstream objects;
+    svg.RenderObjects(objects, begin, end);
+    ostringstream json;
+    Json::PrintEscaped(objects.str(), json);
+    return move(json).str();
+}
+
+// Prints the document as a JSON string in two parts, the second being
+// just the footer, so that more objects can be put in between. Given a
+// pool, ranges of objects are rendered and escaped concurrently, then
+// joined in order; without one the calling thread does it all.
+Json::Raw SerializeSvg(const Svg::Document& svg, ThreadPool* pool) {
+    static constexpr size_t MIN_CHUNK_SIZE = 1024;
+
+    const size_t object_count = svg.GetObjectCount();
+    vector<string> chunks;
+    if (!pool || object_count <= MIN_CHUNK_SIZE) {
+        chunks.push_back(RenderEscaped(svg, 0, object_count));
+    } else {
+        const size_t chunk_size = max(MIN_CHUNK_SIZE, object_count / (pool->GetThreadCount() * 4));
+        vector<future<string>> tasks;
+        for (size_t chunk_begin = 0; chunk_begin < object_count; chunk_begin += chunk_size) {
+            const size_t chunk_end = min(object_count, chunk_begin + chunk_size);
+            tasks.push_back(pool->Submit([&svg, chunk_begin, chunk_end] {
+                return RenderEscaped(svg, chunk_begin, chunk_end);
+            }));
+        }
+        for (auto& task : tasks) {
+            chunks.push_back(task.get());
+        }
+    }
+
+    ostringstream header;
+    svg.RenderHeader(header);
+    ostringstream body;
+    body << '"';
+    Json::PrintEscaped(header.str(), body);
+    for (const string& chunk : chunks) {
+        body << chunk;
+    }
+
+    ostringstream footer;
+    svg.RenderFooter(footer);
+    ostringstream tail;
+    Json::PrintEscaped(footer.str(), tail);
+    tail << '"';
+
+    return {{
+        make_shared<const string>(move(body).str()),
+        make_shared<const string>(move(tail).str()),
+    }};
+}
+
+Json::Raw TransportCatalog::GetSerializedMap() const {
+    call_once(serialized_map_flag_, [this] {
+        TRACE_SPAN("map serialization");
+        // the whole map is serialized once, so its pool lives just as long
+        ThreadPool pool(thread::hardware_concurrency());
+        serialized_map_ = SerializeSvg(map_, &pool);
+    });
+    return serialized_map_;
 }
 
-Svg::Document TransportCatalog::BuildMap(const Descriptions::StopsDict& stops_dict,
-                                         const Descriptions::BusesDict& buses_dict,
-                                         const Json::Dict& render_settings_json) {
-    if (stops_dict.empty()) {
-        return {};
+Json::Raw TransportCatalog::GetSerializedRouteMap(const TransportRouter::RouteInfo& route) const {
+    Json::Raw map = GetSerializedMap();
+    if (!renderer_) {
+        return map;
+    }
+    TRACE_SPAN("route overlay");
+    const Svg::Document overlay = renderer_->RenderRoute(route);
+    Profile::TraceCount("objects", overlay.GetObjectCount());
+    map.parts.insert(
+        prev(end(map.parts)),
+        make_shared<const string>(RenderEscaped(overlay, 0, overlay.GetObjectCount()))
+    );
+    return map;
+}
+
+optional<Json::Raw> TransportCatalog::GetSerializedMapTile(uint32_t zoom, uint32_t x, uint32_t y) const {
+    if (!renderer_ || !MapRenderer::HasTile(zoom, x, y)) {
+        return nullopt;
+    }
+    // x and y are below 2^MAX_TILE_ZOOM, zoom below 2^5
+    const uint64_t key = (uint64_t{zoom} << 42) | (uint64_t{x} << 21) | y;
+    static auto& tile_hits = Metrics::GetCounter(
+        "transport_tile_cache_total", "Map tile lookups, by cache result", {{"result", "hit"}}
+    );
+    static auto& tile_misses = Metrics::GetCounter(
+        "transport_tile_cache_total", "Map tile lookups, by cache result", {{"result", "miss"}}
+    );
+    {
+        lock_guard lock(tiles_mutex_);
+        if (auto it = tiles_.find(key); it != tiles_.end()) {
+            tile_hits.Add();
+            Profile::TraceCount("tile_cache_hits", 1);
+            return it->second;
+        }
+    }
+    tile_misses.Add();
+    TRACE_SPAN("tile rendering");
+
+    // tiles are small and requests already run side by side, so a tile is
+    // serialized on the requesting thread
+    Json::Raw serialized = SerializeSvg(*renderer_->RenderTile(zoom, x, y), nullptr);
+
+    lock_guard lock(tiles_mutex_);
+    // another request may have rendered the same tile meanwhile
+    const auto [it, inserted] = tiles_.emplace(key, move(serialized));
+    Json::Raw result = it->second;
+    if (inserted) {
+        tiles_order_.push_back(key);
+        if (tiles_order_.size() > MAX_CACHED_TILES) {
+            tiles_.erase(tiles_order_.front());
+            tiles_order_.pop_front();
+        }
+    }
+    return result;
+}
+
+Memory::Report TransportCatalog::GetMemoryReport() const {
+    Memory::Report report = {{"network", network_.GetMemoryUsage()}};
+
+    Memory::Usage stops_usage = Memory::GetVectorUsage(stops_);
+    for (const Stop& stop : stops_) {
+        stops_usage += Memory::GetVectorUsage(stop.bus_names);
+    }
+    report.emplace_back("stop responses", stops_usage);
+    report.emplace_back("bus responses", Memory::GetVectorUsage(buses_));
+    report.emplace_back(
+        "serialized responses",
+        Memory::GetStringUsage(serialized_arena_)
+            + Memory::GetVectorUsage(serialized_stops_)
+            + Memory::GetVectorUsage(serialized_buses_)
+    );
+    report.emplace_back("stop k-d tree", stops_tree_.GetMemoryUsage());
+
+    if (router_) {
+        for (auto& item : router_->GetMemoryReport()) {
+            report.push_back(move(item));
+        }
+    }
+    if (renderer_) {
+        report.emplace_back("map renderer", renderer_->GetMemoryUsage());
+    }
+    report.emplace_back("map document", map_.GetMemoryUsage());
+
+    {
+        lock_guard lock(tiles_mutex_);
+        // a deque takes a 512-byte block per 64 keys
+        Memory::Usage tiles_usage = Memory::GetHashTableUsage(tiles_)
+            + Memory::Usage{(tiles_order_.size() / 64 + 1) * 512, tiles_order_.size() / 64 + 1};
+        for (const auto& [key, tile] : tiles_) {
+            tiles_usage += Memory::GetVectorUsage(tile.parts);
+            for (const auto& part : tile.parts) {
+                tiles_usage += Memory::GetStringUsage(*part);
+            }
+        }
+        report.emplace_back("map tile cache", tiles_usage);
+    }
+
+    if (route_cache_) {
+        report.emplace_back("route cache", route_cache_->GetMemoryUsage());
     }
-    return MapRenderer(stops_dict, buses_dict, render_settings_json).Render();
+    report.emplace_back("descriptions (build only)", descriptions_usage_);
+    return report;
 }
@@ -1,21 +1,30 @@
 #pragma once
 
+#include "deadline.h"
 #include "descriptions.h"
 #include "json.h"
+#include "memory_usage.h"
+#include "network.h"
+#include "route_cache.h"
+#include "sphere_kd_tree.h"
 #include "transport_router.h"
 #include "map_renderer.h"
 #include "utils.h"
 
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <optional>
-#include <set>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <variant>
 #include <vector>
 
 namespace Responses {
     struct Stop {
-        std::set<std::string> bus_names;
+        std::vector<std::string_view> bus_names;  // sorted
     };
 
     struct Bus {
@@ -24,6 +33,27 @@ namespace Responses {
         int road_route_length = 0;
         double geo_route_length = 0.0;
     };
+
+    struct NearbyStop {
+        std::string_view name;
+        double distance;
+    };
+
+    Json::Dict ToJson(const Stop& stop);
+    Json::Dict ToJson(const Bus& bus);
+
+    // A response serialized at build time and split where its request_id
+    // goes, so answering it is a copy of bytes
+    struct Serialized {
+        std::string_view head;
+        std::string_view tail;
+
+        Json::Node Splice(int request_id) const;
+    };
+
+    // Appends dict printed as a response to arena, leaving out the value of
+    // its request_id key; returns the sizes of the text before and after it
+    std::pair<size_t, size_t> AppendSerialized(const Json::Dict& dict, std::string& arena);
 }
 
 class TransportCatalog {
@@ -32,32 +62,93 @@ private:
     using Stop = Responses::Stop;
 
 public:
+    struct Options {
+        // Serialize every Stop and Bus response once at build time
+        bool prebuilt_responses = false;
+        // Bytes of recently asked Route responses to keep, none if 0
+        size_t route_cache_bytes = 0;
+    };
+
     TransportCatalog() = default;
     TransportCatalog(std::vector<Descriptions::InputQuery> data,
                      const Json::Dict& routing_settings_json,
-                     const Json::Dict& render_setting_json);
+                     const Json::Dict& render_setting_json,
+                     const Options& options);
 
-    const Stop* GetStop(const std::string& name) const;
-    const Bus* GetBus(const std::string& name) const;
+    // The router and the renderer refer to network_
+    TransportCatalog(const TransportCatalog&) = delete;
+    TransportCatalog& operator=(const TransportCatalog&) = delete;
 
-    std::optional<TransportRouter::RouteInfo> FindRoute(const std::string& stop_from,
-                                                        const std::string& stop_to) const;
+    const Stop* GetStop(std::string_view name) const;
+    const Bus* GetBus(std::string_view name) const;
 
-    std::string RenderMap() const;
+    // nullptr for unknown names and unless built with prebuilt_responses
+    const Responses::Serialized* GetSerializedStop(std::string_view name) const;
+    const Responses::Serialized* GetSerializedBus(std::string_view name) const;
 
-private:
-    static int ComputeRoadRouteLength(const std::vector<std::string>& stops,
-                                      const Descriptions::StopsDict& stops_dict);
+    std::optional<TransportRouter::RouteInfo> FindRoute(std::string_view stop_from,
+                                                        std::string_view stop_to) const;
+    // Routes from one stop to each of stops_to, in their order, see
+    // TransportRouter::FindRoutes
+    std::vector<std::optional<TransportRouter::RouteInfo>> FindRoutes(
+        std::string_view stop_from, const std::vector<std::string_view>& stops_to) const;
+
+    // The "request_timeout_ms" routing setting, the budget of a request
+    // that sets no "timeout_ms" of its own; nullopt for none
+    std::optional<Deadline::Clock::duration> GetRequestTimeout() const;
+
+    std::optional<Network::StopId> FindStopId(std::string_view name) const;
+    // nullptr unless built with route_cache_bytes. The cache goes with this
+    // catalog version, so a reload starts with an empty one.
+    RouteCache* GetRouteCache() const;
 
-    static double ComputeGeoRouteDistance(const std::vector<std::string>& stops,
-                                          const Descriptions::StopsDict& stops_dict);
+    // Stops by distance from point, nearest first: the count nearest ones,
+    // or all that are at most radius meters away
+    std::vector<Responses::NearbyStop> FindNearestStops(Sphere::Point point, size_t count) const;
+    std::vector<Responses::NearbyStop> FindStopsWithin(Sphere::Point point, double radius) const;
 
-    static Svg::Document BuildMap(const Descriptions::StopsDict&,
-                                  const Descriptions::BusesDict&,
-                                  const Json::Dict&);
+    // The map as a JSON string literal, rendered and escaped on first use
+    // and shared by every Map response after that
+    Json::Raw GetSerializedMap() const;
+    // One tile of the map, see MapRenderer::RenderTile. Recent tiles are
+    // cached. nullopt if there is no such tile.
+    std::optional<Json::Raw> GetSerializedMapTile(uint32_t zoom, uint32_t x, uint32_t y) const;
+    // The cached map with the route drawn over it; only the overlay is
+    // rendered per call
+    Json::Raw GetSerializedRouteMap(const TransportRouter::RouteInfo& route) const;
 
-    std::map<std::string, Stop> stops_;
-    std::map<std::string, Bus> buses_;
+    // Heap memory by component, estimated from container sizes. The map
+    // serialized on first use and the bus lines simplified for tiles are
+    // left out; the descriptions are only held while the catalog is built.
+    Memory::Report GetMemoryReport() const;
+
+private:
+    Bus ComputeBusStats(const Network::Bus& bus) const;
+    double ComputeGeoRouteDistance(const std::vector<Network::StopId>& stops) const;
+    void ComputeStopsBusNames();
+    void SerializeResponses();
+    std::vector<Responses::NearbyStop> RankStops(const Sphere::PreparedPoint& point,
+                                                 const std::vector<Network::StopId>& stop_ids) const;
+
+    Network::Model network_;
+    std::vector<Stop> stops_;
+    std::vector<Bus> buses_;
+    std::string serialized_arena_;
+    std::vector<Responses::Serialized> serialized_stops_;
+    std::vector<Responses::Serialized> serialized_buses_;
     std::unique_ptr<TransportRouter> router_;
+    std::unique_ptr<RouteCache> route_cache_;
+    std::optional<Deadline::Clock::duration> request_timeout_;
+    Sphere::KdTree stops_tree_;  // over stop positions, ids are StopIds
+    std::unique_ptr<MapRenderer> renderer_;
     Svg::Document map_;
+    Memory::Usage descriptions_usage_;
+    mutable std::once_flag serialized_map_flag_;
+    mutable Json::Raw serialized_map_;
+
+    // Serialized tiles by key; the oldest is dropped once the cache is full
+    static constexpr size_t MAX_CACHED_TILES = 4096;
+    mutable std::mutex tiles_mutex_;
+    mutable std::unordered_map<uint64_t, Json::Raw> tiles_;
+    mutable std::deque<uint64_t> tiles_order_;
 };
@@ -1,20 +1,85 @@
 #include "transport_router.h"
+#include "metrics.h"
+#include "profile.h"
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
 
 using namespace std;
 
-TransportRouter::TransportRouter(const Descriptions::StopsDict& stops_dict,
-                                 const Descriptions::BusesDict& buses_dict,
+TransportRouter::TransportRouter(const Network::Model& network,
                                  const Json::Dict& routing_settings_json)
-    : routing_settings_(MakeRoutingSettings(routing_settings_json))
+    : network_(network),
+      routing_settings_(MakeRoutingSettings(routing_settings_json))
 {
-    const size_t vertex_count = stops_dict.size() * 2;
-    vertices_info_.resize(vertex_count);
+    engine_ = PlanEngine(network_.GetStops().size(), routing_settings_json).engine;
+
+    const size_t vertex_count = network_.GetStops().size() * 2;
     graph_ = BusGraph(vertex_count);
 
-    FillGraphWithStops(stops_dict);
-    FillGraphWithBuses(stops_dict, buses_dict);
+    {
+        LOG_DURATION("router graph fill");
+        FillGraphWithStops();
+        FillGraphWithBuses();
+    }
+
+    LOG_DURATION("router preprocessing");
+    router_ = std::make_unique<Router>(graph_, engine_);
+}
 
-    router_ = std::make_unique<Router>(graph_);
+size_t GetPhysicalMemory() {
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long page_size = sysconf(_SC_PAGE_SIZE);
+    return pages > 0 && page_size > 0 ? static_cast<size_t>(pages) * page_size : numeric_limits<size_t>::max();
+}
+
+static constexpr size_t MEGABYTE = 1 << 20;
+
+// Half the physical memory unless router_memory_limit_mb is given
+size_t ReadMemoryLimit(const Json::Dict& routing_settings_json) {
+    if (routing_settings_json.count("router_memory_limit_mb") == 0) {
+        return GetPhysicalMemory() / 2;
+    }
+    const double limit_mb = routing_settings_json.at("router_memory_limit_mb").AsDouble();
+    // also rejects NaN
+    if (!(limit_mb >= 0 && limit_mb < static_cast<double>(numeric_limits<size_t>::max() / MEGABYTE))) {
+        throw invalid_argument("router memory limit of " + to_string(limit_mb) + " MB is out of range");
+    }
+    return static_cast<size_t>(limit_mb * MEGABYTE);
+}
+
+TransportRouter::EnginePlan TransportRouter::PlanEngine(size_t stop_count, const Json::Dict& routing_settings_json) {
+    EnginePlan plan{
+        .engine = Graph::RouterEngine::AllPairs,
+        .all_pairs_bytes = Router::EstimateAllPairsBytes(stop_count * 2),
+        .memory_limit = ReadMemoryLimit(routing_settings_json),
+    };
+    const string engine_name = routing_settings_json.count("router_engine") > 0
+        ? routing_settings_json.at("router_engine").AsString()
+        : "auto";
+
+    const bool fits = plan.all_pairs_bytes <= plan.memory_limit;
+    if (engine_name == "dijkstra" || (engine_name == "auto" && !fits)) {
+        plan.engine = Graph::RouterEngine::Dijkstra;
+    } else if (engine_name == "all_pairs" && !fits) {
+        throw length_error(
+            "all-pairs routing table needs " + to_string(plan.all_pairs_bytes / MEGABYTE)
+            + " MB, over the limit of " + to_string(plan.memory_limit / MEGABYTE) + " MB"
+        );
+    } else if (engine_name != "all_pairs" && engine_name != "auto") {
+        throw invalid_argument("unknown router engine " + engine_name);
+    }
+    return plan;
+}
+
+Memory::Report TransportRouter::GetMemoryReport() const {
+    return {
+        {"router graph", graph_.GetMemoryUsage()},
+        {"router edges", Memory::GetVectorUsage(edges_info_) + Memory::GetVectorUsage(stop_ranks_)},
+        {"router table", router_->GetMemoryUsage()},
+    };
 }
 
 TransportRouter::RoutingSettings TransportRouter::MakeRoutingSettings(const Json::Dict& json) {
@@ -24,16 +89,28 @@ TransportRouter::RoutingSettings TransportRouter::MakeRoutingSettings(const Json
     };
 }
 
-void TransportRouter::FillGraphWithStops(const Descriptions::StopsDict& stops_dict) {
-    Graph::VertexId vertex_id = 0;
+TransportRouter::StopVertexIds TransportRouter::GetStopVertexIds(Network::StopId stop_id) const {
+    const Graph::VertexId rank = stop_ranks_[stop_id];
+    return {
+        .in = rank * 2,
+        .out = rank * 2 + 1,
+    };
+}
 
-    for (const auto& [stop_name, _] : stops_dict) {
-        auto& vertex_ids = stops_vertex_ids_[stop_name];
-        vertex_ids.in = vertex_id++;
-        vertex_ids.out = vertex_id++;
-        vertices_info_[vertex_ids.in] = {stop_name};
-        vertices_info_[vertex_ids.out] = {stop_name};
+Network::StopId TransportRouter::GetVertexStopId(Graph::VertexId vertex_id) const {
+    return network_.GetRouterOrder()[vertex_id / 2];
+}
 
+void TransportRouter::FillGraphWithStops() {
+    const auto& order = network_.GetRouterOrder();
+    stop_ranks_.resize(order.size());
+    for (uint32_t rank = 0; rank < order.size(); ++rank) {
+        stop_ranks_[order[rank]] = rank;
+    }
+
+    edges_info_.reserve(order.size());
+    for (const Network::StopId stop_id : order) {
+        const auto vertex_ids = GetStopVertexIds(stop_id);
         edges_info_.push_back(WaitEdgeInfo{});
         graph_.AddEdge({
             vertex_ids.out,
@@ -41,36 +118,30 @@ void TransportRouter::FillGraphWithStops(const Descriptions::StopsDict& stops_di
             static_cast<double>(routing_settings_.bus_wait_time)
         });
     }
-
-    assert(vertex_id == graph_.GetVertexCount());
 }
 
-void TransportRouter::FillGraphWithBuses(const Descriptions::StopsDict& stops_dict,
-                                         const Descriptions::BusesDict& buses_dict) {
-    for (const auto& [_, bus_item] : buses_dict) {
-        const auto& bus = *bus_item;
+void TransportRouter::FillGraphWithBuses() {
+    const auto& buses = network_.GetBuses();
+    for (Network::BusId bus_id = 0; bus_id < buses.size(); ++bus_id) {
+        const auto& bus = buses[bus_id];
         const size_t stop_count = bus.stops.size();
         if (stop_count <= 1) {
             continue;
         }
-        auto compute_distance_from = [&stops_dict, &bus](size_t lhs_idx) {
-            return Descriptions::ComputeStopsDistance(
-                *stops_dict.at(bus.stops[lhs_idx]),
-                *stops_dict.at(bus.stops[lhs_idx + 1])
-            );
-        };
+        const auto& cumulative_distances = bus.cumulative_distances;
         for (size_t start_stop_idx = 0; start_stop_idx + 1 < stop_count; ++start_stop_idx) {
-            const Graph::VertexId start_vertex = stops_vertex_ids_[bus.stops[start_stop_idx]].in;
-            int total_distance = 0;
+            const Graph::VertexId start_vertex = GetStopVertexIds(bus.stops[start_stop_idx]).in;
             for (size_t finish_stop_idx = start_stop_idx + 1; finish_stop_idx < stop_count; ++finish_stop_idx) {
-                total_distance += compute_distance_from(finish_stop_idx - 1);
+                const int total_distance =
+                    cumulative_distances[finish_stop_idx] - cumulative_distances[start_stop_idx];
                 edges_info_.push_back(BusEdgeInfo{
-                    .bus_name = bus.name,
+                    .bus_id = bus_id,
+                    .start_stop_index = start_stop_idx,
                     .span_count = finish_stop_idx - start_stop_idx,
                 });
                 graph_.AddEdge({
                     start_vertex,
-                    stops_vertex_ids_[bus.stops[finish_stop_idx]].out,
+                    GetStopVertexIds(bus.stops[finish_stop_idx]).out,
                     total_distance * 1.0 / (routing_settings_.bus_velocity * 1000.0 / 60)
                 });
             }
@@ -78,36 +149,98 @@ void TransportRouter::FillGraphWithBuses(const Descriptions::StopsDict& stops_di
     }
 }
 
-optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(const string& stop_from, const string& stop_to) const {
-    const Graph::VertexId vertex_from = stops_vertex_ids_.at(stop_from).out;
-    const Graph::VertexId vertex_to = stops_vertex_ids_.at(stop_to).out;
-    const auto route = router_->BuildRoute(vertex_from, vertex_to);
+void CountRoute(Graph::RouterEngine engine, const Graph::Router<double>::SearchWork& work, size_t route_count = 1) {
+    static auto& all_pairs_routes = Metrics::GetCounter(
+        "transport_routes_total", "Routes searched, by router engine", {{"engine", "all_pairs"}}
+    );
+    static auto& dijkstra_routes = Metrics::GetCounter(
+        "transport_routes_total", "Routes searched, by router engine", {{"engine", "dijkstra"}}
+    );
+    static auto& settled_vertices = Metrics::GetCounter(
+        "transport_router_settled_vertices_total", "Vertices settled by Dijkstra searches"
+    );
+    static auto& relaxed_edges = Metrics::GetCounter(
+        "transport_router_relaxed_edges_total", "Edges relaxed by Dijkstra searches"
+    );
+    (engine == Graph::RouterEngine::AllPairs ? all_pairs_routes : dijkstra_routes).Add(route_count);
+    if (work.settled_vertex_count > 0) {
+        settled_vertices.Add(work.settled_vertex_count);
+        relaxed_edges.Add(work.relaxed_edge_count);
+    }
+}
+
+void TraceSearchWork(Graph::RouterEngine engine, const Graph::Router<double>::SearchWork& work) {
+    if (engine == Graph::RouterEngine::Dijkstra) {
+        Profile::TraceCount("settled_vertices", work.settled_vertex_count);
+        Profile::TraceCount("relaxed_edges", work.relaxed_edge_count);
+    }
+}
+
+optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(Network::StopId stop_from, Network::StopId stop_to) const {
+    const Graph::VertexId vertex_from = GetStopVertexIds(stop_from).out;
+    const Graph::VertexId vertex_to = GetStopVertexIds(stop_to).out;
+    Router::SearchWork work;
+    optional<Router::RouteInfo> route;
+    {
+        TRACE_SPAN("path search");
+        route = router_->BuildRoute(vertex_from, vertex_to, &work);
+        TraceSearchWork(engine_, work);
+    }
+    CountRoute(engine_, work);
     if (!route) {
         return nullopt;
     }
+    return ExpandRoute(*route);
+}
+
+vector<optional<TransportRouter::RouteInfo>> TransportRouter::FindRoutes(Network::StopId stop_from,
+                                                                         const vector<Network::StopId>& stops_to) const {
+    vector<Graph::VertexId> vertices_to;
+    vertices_to.reserve(stops_to.size());
+    for (const Network::StopId stop_to : stops_to) {
+        vertices_to.push_back(GetStopVertexIds(stop_to).out);
+    }
+    Router::SearchWork work;
+    vector<optional<Router::RouteInfo>> routes;
+    {
+        TRACE_SPAN("path search");
+        routes = router_->BuildRoutes(GetStopVertexIds(stop_from).out, vertices_to, &work);
+        TraceSearchWork(engine_, work);
+    }
+    CountRoute(engine_, work, routes.size());
 
-    RouteInfo route_info = {.total_time = route->weight};
-    route_info.items.reserve(route->edge_count);
-    for (size_t edge_idx = 0; edge_idx < route->edge_count; ++edge_idx) {
-        const Graph::EdgeId edge_id = router_->GetRouteEdge(route->id, edge_idx);
+    vector<optional<RouteInfo>> route_infos;
+    route_infos.reserve(routes.size());
+    for (const auto& route : routes) {
+        route_infos.push_back(route ? optional(ExpandRoute(*route)) : nullopt);
+    }
+    return route_infos;
+}
+
+TransportRouter::RouteInfo TransportRouter::ExpandRoute(const Router::RouteInfo& route) const {
+    TRACE_SPAN("item expansion");
+    Profile::TraceCount("edges", route.edges.size());
+    RouteInfo route_info = {.total_time = route.weight, .items = {}};
+    route_info.items.reserve(route.edges.size());
+    for (const Graph::EdgeId edge_id : route.edges) {
         const auto& edge = graph_.GetEdge(edge_id);
         const auto& edge_info = edges_info_[edge_id];
         if (holds_alternative<BusEdgeInfo>(edge_info)) {
             const BusEdgeInfo& bus_edge_info = get<BusEdgeInfo>(edge_info);
             route_info.items.push_back(RouteInfo::BusItem{
-                .bus_name = bus_edge_info.bus_name,
+                .bus_name = network_.GetBus(bus_edge_info.bus_id).name,
                 .time = edge.weight,
                 .span_count = bus_edge_info.span_count,
+                .bus_id = bus_edge_info.bus_id,
+                .start_stop_index = bus_edge_info.start_stop_index,
             });
         } else {
             const Graph::VertexId vertex_id = edge.from;
             route_info.items.push_back(RouteInfo::WaitItem{
-                .stop_name = vertices_info_[vertex_id].stop_name,
+                .stop_name = network_.GetStop(GetVertexStopId(vertex_id)).name,
                 .time = edge.weight,
             });
         }
     }
-
-    router_->ReleaseRoute(route->id);
     return route_info;
 }
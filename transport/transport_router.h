@@ -1,12 +1,13 @@
 #pragma once
 
-#include "descriptions.h"
 #include "graph.h"
 #include "json.h"
+#include "memory_usage.h"
+#include "network.h"
 #include "router.h"
 
 #include <memory>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 
 class TransportRouter {
@@ -15,20 +16,39 @@ private:
     using Router = Graph::Router<double>;
 
 public:
-    TransportRouter(const Descriptions::StopsDict& stops_dict,
-                    const Descriptions::BusesDict& buses_dict,
+    // network must outlive the router
+    TransportRouter(const Network::Model& network,
                     const Json::Dict& routing_settings_json);
 
+    // The router engine for a network of stop_count stops, decided before
+    // anything is allocated. The "router_engine" setting is "all_pairs",
+    // "dijkstra" or "auto", the default: all_pairs if its table fits in
+    // "router_memory_limit_mb", which defaults to half the physical memory.
+    // Throws std::length_error if all_pairs is asked for and does not fit.
+    struct EnginePlan {
+        Graph::RouterEngine engine;
+        size_t all_pairs_bytes;
+        size_t memory_limit;  // in bytes
+    };
+    static EnginePlan PlanEngine(size_t stop_count, const Json::Dict& routing_settings_json);
+
+    // The graph, the edge descriptions and the router's table
+    Memory::Report GetMemoryReport() const;
+
     struct RouteInfo {
         double total_time;
 
         struct BusItem {
-            std::string bus_name;
+            std::string_view bus_name;
             double time;
             size_t span_count;
+            // The ride is stops [start_stop_index, start_stop_index + span_count]
+            // of the bus route
+            Network::BusId bus_id;
+            size_t start_stop_index;
         };
         struct WaitItem {
-            std::string stop_name;
+            std::string_view stop_name;
             double time;
         };
 
@@ -36,7 +56,12 @@ public:
         std::vector<Item> items;
     };
 
-    std::optional<RouteInfo> FindRoute(const std::string& stop_from, const std::string& stop_to) const;
+    // Names in the result are views of the network's interned names
+    std::optional<RouteInfo> FindRoute(Network::StopId stop_from, Network::StopId stop_to) const;
+    // Routes from one stop to each of stops_to, in their order, found by
+    // a single search unless the engine is all-pairs
+    std::vector<std::optional<RouteInfo>> FindRoutes(Network::StopId stop_from,
+                                                     const std::vector<Network::StopId>& stops_to) const;
 
 private:
     struct RoutingSettings {
@@ -46,31 +71,36 @@ private:
 
     static RoutingSettings MakeRoutingSettings(const Json::Dict& json);
 
-    void FillGraphWithStops(const Descriptions::StopsDict& stops_dict);
+    // The items of a route found by router_, from the edges it carries
+    RouteInfo ExpandRoute(const Router::RouteInfo& route) const;
 
-    void FillGraphWithBuses(const Descriptions::StopsDict& stops_dict,
-                            const Descriptions::BusesDict& buses_dict);
+    void FillGraphWithStops();
 
+    void FillGraphWithBuses();
+
+    // Every stop has a pair of vertices next to each other, the pairs in
+    // the network's router order
     struct StopVertexIds {
         Graph::VertexId in;
         Graph::VertexId out;
     };
-    struct VertexInfo {
-        std::string stop_name;
-    };
+    StopVertexIds GetStopVertexIds(Network::StopId stop_id) const;
+    Network::StopId GetVertexStopId(Graph::VertexId vertex_id) const;
 
     struct BusEdgeInfo {
-        std::string bus_name;
+        Network::BusId bus_id;
+        size_t start_stop_index;
         size_t span_count;
     };
 
     struct WaitEdgeInfo {};
     using EdgeInfo = std::variant<BusEdgeInfo, WaitEdgeInfo>;
 
+    const Network::Model& network_;
     RoutingSettings routing_settings_;
+    Graph::RouterEngine engine_;
     BusGraph graph_;
     std::unique_ptr<Router> router_;
-    std::unordered_map<std::string, StopVertexIds> stops_vertex_ids_;
-    std::vector<VertexInfo> vertices_info_;
     std::vector<EdgeInfo> edges_info_;
+    std::vector<uint32_t> stop_ranks_;  // by stop id, the index in the router order
 };